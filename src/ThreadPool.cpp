@@ -1,4 +1,6 @@
 #include "ThreadPool.h"
+#include "util/Trace.h"
+#include <algorithm>
 #include <mutex>
 
 ThreadPool::ThreadPool(uint32_t numThreads)
@@ -39,12 +41,17 @@ void ThreadPool::cancel()
 
 void ThreadPool::runBatch(Batch&& batch)
 {
+  TRACE_SCOPE("Batch");
+  // nobody would ever pop an empty batch off the queue
+  if (batch.jobs.empty())
+    return;
   {
     std::unique_lock l(queueLock);
     numRemaining = batch.jobs.size();
     taskQueue.push_back(batch);
     queueCV.notify_all();
   }
+  TRACE_SCOPE("Batch wait");
   while (true)
   {
     std::unique_lock l(queueLock);
@@ -54,13 +61,32 @@ void ThreadPool::runBatch(Batch&& batch)
   }
 }
 
+void ThreadPool::parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)>& fn)
+{
+  Batch batch;
+  for (size_t begin = 0; begin < count; begin += chunkSize)
+  {
+    batch.jobs.push_back(
+        [](const std::function<void(size_t, size_t)>& fn, size_t begin, size_t end) -> Task
+        {
+          fn(begin, end);
+          co_return;
+        }(fn, begin, std::min(begin + chunkSize, count)));
+  }
+  runBatch(std::move(batch));
+}
+
 void ThreadPool::work()
 {
+  Trace::setThreadName("worker");
   while (running)
   {
     Task job;
     {
       std::unique_lock l(queueLock);
+      // checked under the lock, otherwise the shutdown notification can get lost
+      if (!running)
+        return;
       if (taskQueue.empty() || taskQueue.front().jobs.empty())
       {
         queueCV.wait(l);
@@ -70,7 +96,10 @@ void ThreadPool::work()
       taskQueue.front().jobs.pop_front();
       numRunning++;
     }
-    job.handle();
+    {
+      TRACE_SCOPE("Job");
+      job.handle();
+    }
     {
       std::unique_lock l(queueLock);
       numRemaining--;
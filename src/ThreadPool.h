@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <condition_variable>
 #include <functional>
 #include <list>
@@ -26,12 +27,17 @@ struct Batch
 class ThreadPool
 {
 public:
-    ThreadPool(uint32_t numWorkers = std::thread::hardware_concurrency() - 2);
+    // all cores but the two of the main and render threads, at least one, also if the core count is unknown
+    static uint32_t defaultNumWorkers() { return std::max(std::thread::hardware_concurrency(), 3u) - 2; }
+    ThreadPool(uint32_t numWorkers = defaultNumWorkers());
     ~ThreadPool();
+    uint32_t getNumWorkers() const { return (uint32_t)workers.size(); }
     
     // cancel running jobs
     void cancel();
     void runBatch(Batch&& batch);
+    // splits [0, count) into chunks of at most chunkSize and runs fn(begin, end) for each of them
+    void parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)>& fn);
 private:
     std::atomic_bool running = true;
     void work();
@@ -0,0 +1,307 @@
+#include "ThreadPool.h"
+#include "cpu/CPUScene.h"
+#include "util/Camera.h"
+#include "util/ModelLoader.h"
+#include "util/Telemetry.h"
+#include <chrono>
+#include <fstream>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+#include <string>
+
+// headless benchmark over the models in res/models with fixed cameras
+// usage: RayTracerBench [model directory] [output.json] [streaming budget in MB]
+// results are written as json to the output file, or stdout if there is none
+// with a budget the geometry is streamed from a cache file in the working directory
+
+struct BenchScene
+{
+  const char* name;
+  // null for the procedural scene of analytic primitives
+  const char* file;
+  // camera position relative to the center of the scene bounds, scaled by their diagonal
+  glm::vec3 viewOffset;
+};
+
+static const BenchScene SCENES[] = {
+    {"cube", "cube.fbx", glm::vec3(0.8f, 0.3f, 0.5f)},
+    {"box", "box.glb", glm::vec3(0.0f, 0.1f, 0.3f)},
+    {"stanford-bunny", "stanford-bunny.obj", glm::vec3(0.1f, 0.2f, 0.8f)},
+    {"town_hall", "town_hall.glb", glm::vec3(0.05f, 0.05f, 0.2f)},
+    {"spheres", nullptr, glm::vec3(0.1f, 0.2f, 0.5f)},
+};
+
+// a grid of spheres and boxes on a ground plane
+static void addPrimitives(CPUScene& scene)
+{
+  uint32_t red = scene.addMaterial(Material{.albedo = glm::vec3(0.8f, 0.2f, 0.2f)});
+  uint32_t white = scene.addMaterial(Material{.albedo = glm::vec3(0.8f, 0.8f, 0.8f)});
+  scene.addPrimitive(PrimitiveType::Plane, glm::scale(glm::mat4(1.0f), glm::vec3(30, 1, 30)), white);
+  for (int x = -8; x < 8; ++x)
+  {
+    for (int z = -8; z < 8; ++z)
+    {
+      glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(x * 3 + 1.5f, 1, z * 3 + 1.5f));
+      scene.addPrimitive((x + z) % 2 == 0 ? PrimitiveType::Sphere : PrimitiveType::Box, transform, red);
+    }
+  }
+}
+
+static constexpr uint32_t WIDTH = 640;
+static constexpr uint32_t HEIGHT = 360;
+static constexpr uint32_t NUM_SAMPLES = 4;
+
+using Clock = std::chrono::high_resolution_clock;
+
+// runs fn(h) for every image row on the pool and returns the wall time in seconds
+template <typename Fn> static double forEachRow(ThreadPool& pool, Fn& fn)
+{
+  auto start = Clock::now();
+  Batch batch;
+  for (uint32_t h = 0; h < HEIGHT; ++h)
+  {
+    batch.jobs.push_back(
+        [](Fn& fn, uint32_t h) -> Task
+        {
+          fn(h);
+          co_return;
+        }(fn, h));
+  }
+  pool.runBatch(std::move(batch));
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static double mrays(uint64_t rays, double seconds) { return rays / seconds / 1e6; }
+
+struct EndToEnd
+{
+  double samplesPerSecond;
+  double mraysPerSecond;
+};
+
+// full paths through tracePaths, a row at a time like the columns of a render pass of CPURenderer
+// extra are the optional path features on top of shadows and bounces
+static EndToEnd traceSamples(CPUScene& scene, const Camera& camera, ThreadPool& pool, uint32_t extra = 0)
+{
+  RayStats before = Telemetry::collect();
+  double seconds = 0;
+  CPUScene::PathTracer tracer = scene.getPathTracer(scene.getPathFeatures(CPUScene::ShadowFeature | CPUScene::BounceFeature | extra));
+  for (uint32_t samp = 0; samp < NUM_SAMPLES; ++samp)
+  {
+    auto pass = [&](uint32_t h)
+    {
+      std::vector<Ray> rays(WIDTH);
+      std::vector<Payload> payloads(WIDTH);
+      for (uint32_t w = 0; w < WIDTH; ++w)
+      {
+        payloads[w].seed = glm::uvec3(w, h, samp);
+        payloads[w].rnd01 = rand01(payloads[w].seed);
+        payloads[w].coneSpread = camera.pixelSpread(glm::uvec2(WIDTH, HEIGHT));
+        rays[w] = camera.generateRay(glm::uvec2(w, h), samp, glm::uvec2(WIDTH, HEIGHT), payloads[w].rnd01);
+      }
+      (scene.*tracer)(rays, payloads, 1e-4, 1e20);
+    };
+    scene.prefetchVisible(camera, glm::uvec2(WIDTH, HEIGHT));
+    seconds += forEachRow(pool, pass);
+    scene.trimCaches();
+  }
+  RayStats traced = Telemetry::collect() - before;
+  return EndToEnd{
+      .samplesPerSecond = WIDTH * HEIGHT * NUM_SAMPLES / seconds,
+      .mraysPerSecond = mrays(traced.totalRays(), seconds),
+  };
+}
+
+static void benchScene(const BenchScene& desc, const std::string& modelDir, uint64_t streamingBudget, std::ostream& out)
+{
+  std::cerr << "benchmarking " << desc.name << std::endl;
+  const DirectionalLight light = DirectionalLight{
+      .direction = glm::normalize(glm::vec3(-0.4f, -0.3f, -0.2f)),
+      .color = glm::vec3(1, 1, 1),
+  };
+  uint32_t numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  ThreadPool pool(numThreads);
+  CPUScene scene;
+  scene.addDirectionalLight(light);
+  scene.addPointLight(PointLight{});
+  if (streamingBudget > 0)
+  {
+    scene.setGeometryStreaming("bench-geometry.cache", streamingBudget);
+  }
+
+  RayStats sceneBefore = Telemetry::collect();
+  auto start = Clock::now();
+  if (desc.file != nullptr)
+    scene.addModels(ModelLoader::loadModel(modelDir + "/" + desc.file, pool), glm::mat4(1.0f));
+  else
+    addPrimitives(scene);
+  double loadTime = std::chrono::duration<double>(Clock::now() - start).count();
+  start = Clock::now();
+  scene.generate(pool);
+  double buildTime = std::chrono::duration<double>(Clock::now() - start).count();
+
+  // a model that failed to load leaves nothing to trace, the scene is reported without results
+  if (scene.hierarchy == nullptr)
+  {
+    std::cerr << desc.name << " has no geometry" << std::endl;
+    out << "    {\n";
+    out << "      \"name\": \"" << desc.name << "\",\n";
+    out << "      \"error\": \"no geometry\"\n";
+    out << "    }";
+    return;
+  }
+  const AABB& bounds = scene.hierarchy->aabb;
+  glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+  Camera camera = Camera{
+      .position = center + desc.viewOffset * glm::length(bounds.max - bounds.min),
+      .target = center,
+      .S_O = 6,
+      .f = 0,
+      .A = 0,
+  };
+
+  const glm::uvec2 dims = glm::uvec2(WIDTH, HEIGHT);
+
+  // primary rays, the hits are the origins of the shadow and bounce rays
+  std::vector<IntersectionInfo> hits(WIDTH * HEIGHT);
+  auto primary = [&](uint32_t h)
+  {
+    for (uint32_t w = 0; w < WIDTH; ++w)
+    {
+      glm::uvec2 pix = glm::uvec2(w, h);
+      hits[w + h * WIDTH] = scene.generateIntersections(scene.hierarchy, camera.generateRay(pix, 0, dims, rand01(glm::uvec3(pix, 0))), 1e-4, 1e20);
+    }
+  };
+  double primaryTime = forEachRow(pool, primary);
+  uint64_t numHits = std::count_if(hits.begin(), hits.end(), [](const IntersectionInfo& info)
+                                   { return info.hitInfo.t < std::numeric_limits<float>::max(); });
+
+  auto shadow = [&](uint32_t h)
+  {
+    for (uint32_t w = 0; w < WIDTH; ++w)
+    {
+      const HitInfo& hit = hits[w + h * WIDTH].hitInfo;
+      if (hit.t < std::numeric_limits<float>::max())
+        scene.testIntersection(scene.hierarchy, Ray(hit.position, -light.direction), 1e-4, 1e20);
+    }
+  };
+  double shadowTime = forEachRow(pool, shadow);
+
+  // the same shadow ray and one towards the point light as a single query per hit
+  const PointLight point = PointLight{};
+  auto occlusion = [&](uint32_t h)
+  {
+    for (uint32_t w = 0; w < WIDTH; ++w)
+    {
+      const HitInfo& hit = hits[w + h * WIDTH].hitInfo;
+      if (hit.t == std::numeric_limits<float>::max())
+        continue;
+      OcclusionQuery query;
+      query.origin = hit.position;
+      query.numRays = 2;
+      query.directions[0] = -light.direction;
+      query.tmax[0] = 1e20f;
+      query.directions[1] = point.position - hit.position;
+      query.tmax[1] = 1.0f;
+      scene.testLightOcclusion(query, 0, 1e-4, 0b11);
+    }
+  };
+  RayStats occlusionBefore = Telemetry::collect();
+  double occlusionTime = forEachRow(pool, occlusion);
+  RayStats occlusionStats = Telemetry::collect() - occlusionBefore;
+
+  auto bounce = [&](uint32_t h)
+  {
+    for (uint32_t w = 0; w < WIDTH; ++w)
+    {
+      const HitInfo& hit = hits[w + h * WIDTH].hitInfo;
+      if (hit.t < std::numeric_limits<float>::max())
+      {
+        glm::vec3 direction = sampleHemisphere(hit.normalLight, glm::vec2(rand01(glm::uvec3(w, h, 1))));
+        scene.generateIntersections(scene.hierarchy, Ray(hit.position, direction), 1e-4, 1e20);
+      }
+    }
+  };
+  double bounceTime = forEachRow(pool, bounce);
+
+  EndToEnd endToEnd = traceSamples(scene, camera, pool);
+  // the cache is trained by a first round of samples, the measured ones mostly end at the first bounce
+  scene.radianceCache.setCellSize(glm::length(bounds.max - bounds.min) / 256);
+  traceSamples(scene, camera, pool, CPUScene::RadianceCacheFeature);
+  RayStats cacheBefore = Telemetry::collect();
+  EndToEnd cached = traceSamples(scene, camera, pool, CPUScene::RadianceCacheFeature);
+  RayStats cacheStats = Telemetry::collect() - cacheBefore;
+  // the same for the guide, the first round trains it and the measured one samples it
+  scene.pathGuide.setCellSize(glm::length(bounds.max - bounds.min) / 64);
+  traceSamples(scene, camera, pool, CPUScene::GuideFeature);
+  EndToEnd guided = traceSamples(scene, camera, pool, CPUScene::GuideFeature);
+  // bottom level hierarchies are built by the first rays that reach them, not in generate
+  RayStats sceneStats = Telemetry::collect() - sceneBefore;
+
+  out << "    {\n";
+  out << "      \"name\": \"" << desc.name << "\",\n";
+  out << "      \"triangles\": " << scene.getNumTriangles() << ",\n";
+  out << "      \"models\": " << scene.getNumModels() << ",\n";
+  out << "      \"instances\": " << scene.getNumInstances() << ",\n";
+  out << "      \"primitives\": " << scene.getNumPrimitives() << ",\n";
+  GeometryMemory memory = scene.getGeometryMemory();
+  out << "      \"geometryBytes\": " << memory.bytes << ",\n";
+  out << "      \"bytesPerTriangle\": " << memory.bytesPerTriangle() << ",\n";
+  out << "      \"uncompressedBytesPerTriangle\": " << memory.uncompressedBytesPerTriangle() << ",\n";
+  out << "      \"residentGeometryBytes\": " << memory.residentBytes << ",\n";
+  out << "      \"loadSeconds\": " << loadTime << ",\n";
+  out << "      \"buildSeconds\": " << buildTime << ",\n";
+  out << "      \"lazyHierarchyBuilds\": " << sceneStats[Counter::HierarchyBuilds] << ",\n";
+  out << "      \"lazyHierarchySeconds\": " << sceneStats[Counter::HierarchyBuildMicroseconds] / 1e6 << ",\n";
+  out << "      \"primaryMraysPerSecond\": " << mrays(WIDTH * HEIGHT, primaryTime) << ",\n";
+  out << "      \"shadowMraysPerSecond\": " << mrays(numHits, shadowTime) << ",\n";
+  out << "      \"occlusionQueryMraysPerSecond\": " << mrays(2 * numHits, occlusionTime) << ",\n";
+  out << "      \"occluderCacheHitRate\": "
+      << double(occlusionStats[Counter::OccluderCacheHits]) / std::max<uint64_t>(occlusionStats[Counter::OccluderCacheLookups], 1) << ",\n";
+  out << "      \"bounceMraysPerSecond\": " << mrays(numHits, bounceTime) << ",\n";
+  out << "      \"samplesPerSecond\": " << endToEnd.samplesPerSecond << ",\n";
+  out << "      \"mraysPerSecond\": " << endToEnd.mraysPerSecond << ",\n";
+  out << "      \"radianceCacheSamplesPerSecond\": " << cached.samplesPerSecond << ",\n";
+  out << "      \"radianceCacheHitRate\": "
+      << double(cacheStats[Counter::RadianceCacheHits]) / std::max<uint64_t>(cacheStats[Counter::RadianceCacheLookups], 1) << ",\n";
+  out << "      \"radianceCacheCells\": " << scene.radianceCache.getNumUsedCells() << ",\n";
+  out << "      \"pathGuidingSamplesPerSecond\": " << guided.samplesPerSecond << ",\n";
+  out << "      \"pathGuideCells\": " << scene.pathGuide.getNumUsedCells() << ",\n";
+  out << "      \"threadScaling\": [";
+  for (uint32_t threads = 1;; threads = std::min(threads * 2, numThreads))
+  {
+    ThreadPool scalingPool(threads);
+    EndToEnd result = traceSamples(scene, camera, scalingPool);
+    out << (threads > 1 ? ", " : "") << "{\"threads\": " << threads << ", \"samplesPerSecond\": " << result.samplesPerSecond << "}";
+    if (threads == numThreads)
+      break;
+  }
+  out << "]\n";
+  out << "    }";
+}
+
+int main(int argc, char** argv)
+{
+  std::string modelDir = argc > 1 ? argv[1] : "../../res/models";
+  std::ofstream file;
+  if (argc > 2)
+  {
+    file.open(argv[2]);
+  }
+  std::ostream& out = argc > 2 ? file : std::cout;
+  uint64_t streamingBudget = argc > 3 ? std::stoull(argv[3]) * 1000000 : 0;
+
+  out << "{\n";
+  out << "  \"width\": " << WIDTH << ",\n";
+  out << "  \"height\": " << HEIGHT << ",\n";
+  out << "  \"samples\": " << NUM_SAMPLES << ",\n";
+  out << "  \"scenes\": [\n";
+  for (size_t i = 0; i < std::size(SCENES); ++i)
+  {
+    benchScene(SCENES[i], modelDir, streamingBudget, out);
+    out << (i + 1 < std::size(SCENES) ? ",\n" : "\n");
+  }
+  out << "  ]\n";
+  out << "}\n";
+  return 0;
+}
@@ -1,12 +1,19 @@
 #include "CPURenderer.h"
 #include "scene/Renderer.h"
 #include "CPUScene.h"
+#include "util/Color.h"
+#include "util/Trace.h"
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
+#include <cmath>
+#include <fstream>
 
 #define GLSL(...) "#version 400\n" #__VA_ARGS__
 
+// relative difference in first hit distance above which reprojected history is rejected
+static constexpr float DISOCCLUSION_THRESHOLD = 0.05f;
+
 static void glfw_error_callback(int error, const char* description)
 {
     fprintf(stderr, "Glfw Error %d: %s\n", error, description);
@@ -105,14 +112,58 @@ CPURenderer::CPURenderer()
 
 CPURenderer::~CPURenderer()
 {
-  
+  // the render and generate threads use the scenes, which go away with this
+  stopRender();
+  if (generator.joinable())
+    generator.join();
+  delete scene;
+}
+
+void CPURenderer::generate()
+{
+  scene->generate(threadPool);
+  active.store(scene, std::memory_order_release);
 }
 
-glm::vec3 rand01(glm::uvec3 x)
-{ // pseudo-random number generator
-  for (int i = 3; i-- > 0;)
-    x = ((x >> 8U) ^ glm::uvec3(x.y, x.z, x.x)) * 1103515245U;
-  return glm::vec3(x) * (1.0f / float(0xffffffffU));
+void CPURenderer::generateAsync(std::function<void(ThreadPool&)> load)
+{
+  // nothing may trace the scene while the models are added and generated
+  stopRender();
+  if (generator.joinable())
+    generator.join();
+  active.store(nullptr, std::memory_order_release);
+  preview.reset();
+  generating = true;
+  generator = std::thread(
+      [this, load = std::move(load)]
+      {
+        Trace::setThreadName("generate");
+        // threadPool belongs to the render thread, which is busy with the preview,
+        // this one gets half as many workers so the two do not oversubscribe the cores
+        ThreadPool pool(std::max(threadPool.getNumWorkers() / 2, 1u));
+        if (load)
+          load(pool);
+        auto boxes = std::make_unique<CPUScene>();
+        scene->createPreview(*boxes);
+        boxes->generate(pool);
+        // without any models there is nothing to preview
+        if (boxes->hierarchy)
+        {
+          preview = std::move(boxes);
+          active.store(preview.get(), std::memory_order_release);
+          sceneUpdated = true;
+        }
+        scene->generate(pool);
+        active.store(scene, std::memory_order_release);
+        generating.store(false, std::memory_order_release);
+        sceneUpdated = true;
+      });
+}
+
+GeometryMemory CPURenderer::getGeometryMemory() const
+{
+  CPUScene* current = active.load(std::memory_order_acquire);
+  return current == scene ? scene->getGeometryMemory() : GeometryMemory{};
 }
 
 void CPURenderer::beginFrame()
@@ -126,6 +177,7 @@ void CPURenderer::beginFrame()
 
 void CPURenderer::update()
 {
+  TRACE_SCOPE("CPURenderer::update");
   glBindTexture(GL_TEXTURE_2D, texture);
   glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_FLOAT, image.data());
   glUseProgram(program);
@@ -137,71 +189,309 @@ void CPURenderer::update()
 
 void CPURenderer::render(Camera camera, RenderParameter params)
 {
+  Trace::setThreadName("render");
+  // fixed for the whole render, the next scene is shown by starting the render again
+  CPUScene* traced = active.load(std::memory_order_acquire);
+  if (traced == nullptr)
+    return;
+  if (params.mode != RenderMode::Shaded)
+  {
+    renderTraversalCost(*traced, camera, params);
+    return;
+  }
+  reproject(camera, params);
   image.clear();
   image.resize(params.width * params.height);
+  radiance.clear();
+  radiance.resize(params.width * params.height);
   accumulator.clear();
   accumulator.resize(params.width * params.height);
+  accumulatorSquares.clear();
+  if (params.targetError > 0)
+    accumulatorSquares.resize(params.width * params.height);
+  depth.clear();
+  depth.resize(params.width * params.height, std::numeric_limits<float>::max());
+  if (params.radianceCache)
+  {
+    // the cache is kept across renders as long as it stays on and the paths that train it see the same lights
+    if (!lastParams.radianceCache || params.shadows != lastParams.shadows)
+      traced->radianceCache.clear();
+    traced->radianceCache.setCellSize(params.cacheCellSize);
+    traced->radianceCache.setUpdateRate(params.cacheUpdateRate);
+    traced->radianceCache.setDepth(params.cacheDepth);
+  }
+  if (params.pathGuiding)
+  {
+    // the same for the guide, it keeps learning over all renders of the same lighting
+    if (!lastParams.pathGuiding || params.shadows != lastParams.shadows)
+      traced->pathGuide.clear();
+    traced->pathGuide.setCellSize(params.guideCellSize);
+    traced->pathGuide.setGuideFraction(params.guideFraction);
+  }
+  lastCamera = camera;
+  lastParams = params;
+  completedSamples = 0;
+  // the integrator variant for this scene and these settings, picked once for all passes
+  uint32_t optional = (params.shadows ? CPUScene::ShadowFeature : 0) | (params.bounces ? CPUScene::BounceFeature : 0) |
+                      (params.radianceCache ? CPUScene::RadianceCacheFeature : 0) | (params.pathGuiding ? CPUScene::GuideFeature : 0);
+  uint32_t features = traced->getPathFeatures(optional);
+  CPUScene::PathTracer tracer = traced->getPathTracer(features);
   for (int samp = 0; samp < params.numSamples; ++samp)
   {
     if (!running)
       return;
+    TRACE_SCOPE("Sample pass");
     auto start = std::chrono::high_resolution_clock::now();
+    RayStats before = Telemetry::collect();
+    // streamed models the camera sees are read ahead of the columns
+    traced->prefetchVisible(camera, glm::uvec2(params.width, params.height));
+    float coneSpread = camera.pixelSpread(glm::uvec2(params.width, params.height));
     Batch batch;
     for (int w = 0; w < params.width; ++w)
     {
       batch.jobs.push_back(
           [&](int w, int samp) -> Task
           {
-            // #pragma omp parallel for
+            // the whole column is traced together, so its hits can be shaded per material
+            std::vector<Ray> rays(params.height);
+            std::vector<Payload> payloads(params.height);
             for (int h = 0; h < params.height; ++h)
             {
-              Payload payload;
-              Ray cam = Ray(camera.position, glm::normalize(camera.target - camera.position));
-              glm::vec3 cx =
-                            glm::normalize(glm::cross(cam.direction, abs(cam.direction.y) < 0.9 ? glm::vec3(0, 1, 0) : glm::vec3(0, 0, 1))),
-                        cy = glm::cross(cx, cam.direction);
-              const glm::vec2 sdim = camera.sensorSize; // sensor size (36 x 24 mm)
-
-              float S_I = (camera.S_O * camera.f) / (camera.S_O - camera.f);
-
-              //-- sample sensor
               glm::uvec2 pix = glm::uvec2(w, h);
+              payloads[h].seed = glm::uvec3(pix, samp);
+              payloads[h].rnd01 = rand01(payloads[h].seed);
+              payloads[h].coneSpread = coneSpread;
+              rays[h] = camera.generateRay(pix, samp, glm::uvec2(params.width, params.height), payloads[h].rnd01);
+            }
+            (traced->*tracer)(rays, payloads, 1e-4, 1e20);
 
-              payload.rnd01 = rand01(glm::uvec3(pix, samp));
-              glm::vec2 rnd2 = 2.0f * glm::vec2(payload.rnd01); // vvv tent filter sample
-              glm::vec2 tent =
-                  glm::vec2(rnd2.x < 1 ? sqrt(rnd2.x) - 1 : 1 - sqrt(2 - rnd2.x), rnd2.y < 1 ? sqrt(rnd2.y) - 1 : 1 - sqrt(2 - rnd2.y));
-              glm::vec2 s =
-                  ((glm::vec2(pix) + 0.5f * (0.5f + glm::vec2((samp / 2) % 2, samp % 2) + tent)) / glm::vec2(params.width, params.height) -
-                   0.5f) *
-                  sdim;
-              glm::vec3 spos = cam.origin + cx * s.x + cy * s.y, lc = cam.origin + cam.direction * 0.035f; // sample on 3d sensor plane
-              Ray r = Ray(lc, normalize(lc - spos));                                                       // construct ray
-
-              //-- setup lens
-              glm::vec3 lensP = lc;
-              glm::vec3 lensN = -cam.direction;
-              glm::vec3 lensX = glm::cross(lensN, glm::vec3(0, 1, 0)); // the exact vector doesnt matter
-              glm::vec3 lensY = glm::cross(lensN, lensX);
-
-              glm::vec3 lensSample = lensP + payload.rnd01.x * camera.A * lensX + payload.rnd01.y * camera.A * lensY;
-
-              glm::vec3 focalPoint = cam.origin + (camera.S_O + S_I) * cam.direction;
-              float t = glm::dot(focalPoint - r.origin, lensN) / glm::dot(r.direction, lensN);
-              glm::vec3 focus = r.origin + t * r.direction;
-              r = Ray(lensSample, normalize(focus - lensSample)); // TODO: Fix lens
-
-              scene->traceRay(r, payload, 1e-4, 1e20);
-
-              float resolver = float(params.numSamples) / float(samp + 1);
-              accumulator[w + h * params.width] += payload.accumulatedRadiance / float(params.numSamples);
-              image[w + h * params.width] = glm::pow(glm::max(accumulator[w + h * params.width] * resolver, 0.0f), glm::vec3(0.45f));
+            for (int h = 0; h < params.height; ++h)
+            {
+              const Payload& payload = payloads[h];
+              uint32_t index = w + h * params.width;
+              depth[index] = payload.hitDistance;
+              // the first sample decides if the reprojected surface is still visible
+              if (samp == 0 && !historyWeight.empty() && historyWeight[index] > 0 &&
+                  std::abs(depth[index] - historyDepth[index]) > DISOCCLUSION_THRESHOLD * depth[index])
+              {
+                historyWeight[index] = 0;
+              }
+              accumulator[index] += payload.accumulatedRadiance;
+              if (!accumulatorSquares.empty())
+              {
+                float l = luminance(payload.accumulatedRadiance);
+                accumulatorSquares[index] += l * l;
+              }
+              radiance[index] = resolve(index, samp + 1);
+              image[index] = glm::pow(glm::max(radiance[index], 0.0f), glm::vec3(0.45f));
             }
             co_return;
           }(w, samp));
     }
     threadPool.runBatch(std::move(batch));
+    {
+      // every pixel is written again by the next pass, so the buffer swapped back only needs the right size
+      std::lock_guard lock(finishedMutex);
+      std::swap(radiance, finishedRadiance);
+      finishedSize = glm::uvec2(params.width, params.height);
+    }
+    radiance.resize(params.width * params.height);
+    traced->trimCaches();
+    completedSamples = samp + 1;
     auto end = std::chrono::high_resolution_clock::now();
-    sampleTimes.push_back(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0f);
+    recordPass(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0f,
+               (Telemetry::collect() - before).totalRays());
+    // the image is complete and normalized after every pass, so stopping here leaves nothing half done
+    if (!continueRender(params, completedSamples, params.targetError > 0 ? estimateError(completedSamples) : -1.0f))
+      break;
+  }
+}
+
+glm::vec3 CPURenderer::resolve(uint32_t index, uint32_t numSamples) const
+{
+  glm::vec3 mean = accumulator[index] / float(numSamples);
+  if (historyWeight.empty() || historyWeight[index] == 0)
+  {
+    return mean;
+  }
+  return (mean * float(numSamples) + history[index] * historyWeight[index]) / (float(numSamples) + historyWeight[index]);
+}
+
+float CPURenderer::estimateError(uint32_t numSamples) const
+{
+  TRACE_SCOPE("CPURenderer::estimateError");
+  if (numSamples < 2)
+    return -1.0f;
+  // variance of the mean over the squared mean, summed over the image so dark pixels do not dominate
+  double variance = 0;
+  double energy = 0;
+  float n = float(numSamples);
+  for (size_t i = 0; i < accumulator.size(); ++i)
+  {
+    float mean = luminance(accumulator[i]) / n;
+    float sampleVariance = std::max(accumulatorSquares[i] / n - mean * mean, 0.0f) * n / (n - 1);
+    variance += sampleVariance / n;
+    energy += mean * mean;
+  }
+  return energy > 0 ? (float)std::sqrt(variance / energy) : 0.0f;
+}
+
+void CPURenderer::reproject(Camera camera, RenderParameter params)
+{
+  TRACE_SCOPE("CPURenderer::reproject");
+  bool valid = params.reproject && completedSamples > 0 && params.width == lastParams.width && params.height == lastParams.height;
+  uint32_t numPixels = params.width * params.height;
+  std::vector<glm::vec3> previous;
+  std::vector<float> previousWeight;
+  if (valid)
+  {
+    previous.resize(numPixels);
+    previousWeight.resize(numPixels);
+    for (uint32_t i = 0; i < numPixels; ++i)
+    {
+      previous[i] = resolve(i, completedSamples);
+      previousWeight[i] = std::min(float(completedSamples) + (historyWeight.empty() ? 0 : historyWeight[i]), params.historyLength);
+    }
+  }
+  history.clear();
+  historyWeight.clear();
+  historyDepth.clear();
+  if (!valid)
+    return;
+  history.resize(numPixels);
+  historyWeight.resize(numPixels, 0);
+  historyDepth.resize(numPixels, std::numeric_limits<float>::max());
+
+  glm::uvec2 dims = glm::uvec2(params.width, params.height);
+  // unprojecting at distance 0 gives the lens center, where hitDistance is measured from
+  glm::vec3 lensCenter = camera.unproject(glm::uvec2(0, 0), dims, 0);
+  for (uint32_t h = 0; h < params.height; ++h)
+  {
+    for (uint32_t w = 0; w < params.width; ++w)
+    {
+      uint32_t index = w + h * params.width;
+      if (depth[index] == std::numeric_limits<float>::max())
+        continue;
+      glm::vec3 position = lastCamera.unproject(glm::uvec2(w, h), dims, depth[index]);
+      glm::ivec2 pix;
+      if (!camera.project(position, dims, pix) || pix.x < 0 || pix.y < 0 || pix.x >= (int)params.width || pix.y >= (int)params.height)
+        continue;
+      uint32_t target = pix.x + pix.y * params.width;
+      float distance = glm::length(position - lensCenter);
+      // several pixels can land on the same target, the closest surface wins
+      if (distance >= historyDepth[target])
+        continue;
+      history[target] = previous[index];
+      historyWeight[target] = previousWeight[index];
+      historyDepth[target] = distance;
+    }
+  }
+}
+
+// blue over green to red
+static glm::vec3 heatColor(float t)
+{
+  const glm::vec3 stops[] = {glm::vec3(0, 0, 0.5f), glm::vec3(0, 0.5f, 1), glm::vec3(0, 1, 0), glm::vec3(1, 1, 0), glm::vec3(1, 0, 0)};
+  t = glm::clamp(t, 0.0f, 1.0f) * (std::size(stops) - 1);
+  uint32_t i = std::min((uint32_t)t, (uint32_t)std::size(stops) - 2);
+  return glm::mix(stops[i], stops[i + 1], t - i);
+}
+
+void CPURenderer::renderTraversalCost(CPUScene& traced, Camera camera, RenderParameter params)
+{
+  TRACE_SCOPE("CPURenderer::renderTraversalCost");
+  image.clear();
+  image.resize(params.width * params.height);
+  traversalCost.clear();
+  traversalCost.resize(params.width * params.height);
+  traversalCostSize = glm::uvec2(params.width, params.height);
+  completedSamples = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+  RayStats before = Telemetry::collect();
+  traced.prefetchVisible(camera, glm::uvec2(params.width, params.height));
+  Batch batch;
+  for (int w = 0; w < params.width; ++w)
+  {
+    batch.jobs.push_back(
+        [&](int w) -> Task
+        {
+          // the column runs on a single worker, so the difference of its counters is the cost of the ray
+          RayCounters& counters = Telemetry::local();
+          for (int h = 0; h < params.height; ++h)
+          {
+            glm::uvec2 pix = glm::uvec2(w, h);
+            Ray r = camera.generateRay(pix, 0, glm::uvec2(params.width, params.height), rand01(glm::uvec3(pix, 0)));
+            uint64_t nodes = counters.counters[(size_t)Counter::NodesVisited].load(std::memory_order_relaxed);
+            uint64_t triangles = counters.counters[(size_t)Counter::TriangleTests].load(std::memory_order_relaxed);
+            counters.add(Counter::PrimaryRays);
+            traced.generateIntersections(traced.hierarchy, r, 1e-4, 1e20);
+            traversalCost[w + h * params.width] =
+                glm::uvec2(counters.counters[(size_t)Counter::NodesVisited].load(std::memory_order_relaxed) - nodes,
+                           counters.counters[(size_t)Counter::TriangleTests].load(std::memory_order_relaxed) - triangles);
+          }
+          co_return;
+        }(w));
+  }
+  threadPool.runBatch(std::move(batch));
+  traced.trimCaches();
+
+  // log scale, a few pathological pixels would wash out everything else otherwise
+  uint32_t channel = params.mode == RenderMode::NodeHeatmap ? 0 : 1;
+  uint32_t maxCost = 1;
+  for (const auto& cost : traversalCost)
+  {
+    maxCost = std::max(maxCost, cost[channel]);
+  }
+  for (uint32_t i = 0; i < traversalCost.size(); ++i)
+  {
+    image[i] = heatColor(std::log1p(float(traversalCost[i][channel])) / std::log1p(float(maxCost)));
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  recordPass(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0f,
+             (Telemetry::collect() - before).totalRays());
+}
+
+void CPURenderer::writeTraversalCost(std::string_view filename) const
+{
+  std::ofstream out{std::string(filename), std::ios::binary};
+  out << "PF\n" << traversalCostSize.x << " " << traversalCostSize.y << "\n-1.0\n";
+  // pfm scanlines go from bottom to top
+  for (uint32_t h = traversalCostSize.y; h-- > 0;)
+  {
+    for (uint32_t w = 0; w < traversalCostSize.x; ++w)
+    {
+      glm::uvec2 cost = traversalCost[w + h * traversalCostSize.x];
+      float pixel[3] = {float(cost.x), float(cost.y), 0.0f};
+      out.write((const char*)pixel, sizeof(pixel));
+    }
+  }
+}
+
+void CPURenderer::writeImage(std::string_view filename) const
+{
+  // a copy, so the render thread is not held up by the file
+  std::vector<glm::vec3> pixels;
+  glm::uvec2 size;
+  {
+    std::lock_guard lock(finishedMutex);
+    pixels = finishedRadiance;
+    size = finishedSize;
+  }
+  if (pixels.empty())
+  {
+    std::cout << "No image to write to " << filename << std::endl;
+    return;
+  }
+  std::ofstream out{std::string(filename), std::ios::binary};
+  out << "PF\n" << size.x << " " << size.y << "\n-1.0\n";
+  // pfm scanlines go from bottom to top
+  for (uint32_t h = size.y; h-- > 0;)
+  {
+    for (uint32_t w = 0; w < size.x; ++w)
+    {
+      glm::vec3 pixel = pixels[w + h * size.x];
+      float rgb[3] = {pixel.x, pixel.y, pixel.z};
+      out.write((const char*)rgb, sizeof(rgb));
+    }
   }
 }
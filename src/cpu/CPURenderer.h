@@ -3,6 +3,7 @@
 #include "scene/Renderer.h"
 #include "util/Camera.h"
 #include "ThreadPool.h"
+#include <mutex>
 #include <GL/glew.h>
 #include <glfw/glfw3.h>
 
@@ -14,20 +15,60 @@ public:
     
     virtual void addPointLight(PointLight point) override { scene->addPointLight(point); }
     virtual void addDirectionalLight(DirectionalLight dir) override { scene->addDirectionalLight(dir); }
+    virtual void setEnvironmentMap(PEnvironmentMap map) override { scene->setEnvironmentMap(std::move(map)); }
     virtual void addModel(PModel model, glm::mat4 transform) override { scene->addModel(std::move(model), transform); }
-    virtual void addModels(std::vector<PModel> models, glm::mat4 transform) override { scene->addModels(std::move(models), transform); }
-    virtual void generate() override { scene->generate(); }
+    virtual void addModels(ModelGroup group, glm::mat4 transform) override { scene->addModels(std::move(group), transform); }
+    virtual void generate() override;
+    // traces a box per model while the scene generates
+    virtual void generateAsync(std::function<void(ThreadPool&)> load) override;
+    virtual float getGenerateProgress() const override { return isGenerating() ? scene->getGenerateProgress() : 1.0f; }
+    virtual GeometryMemory getGeometryMemory() const override;
+    // call before generate, see CPUScene::setGeometryStreaming
+    void setGeometryStreaming(std::string_view cacheFile, uint64_t budgetBytes) { scene->setGeometryStreaming(cacheFile, budgetBytes); }
+    void setTextureBudget(uint64_t budgetBytes) { scene->textures.setBudget(budgetBytes); }
 
     virtual void beginFrame() override;
     virtual void update() override;
+    virtual void writeTraversalCost(std::string_view filename) const override;
+    virtual void writeImage(std::string_view filename) const override;
 protected:
     virtual void render(Camera camera, RenderParameter params) override;
+    // one primary ray per pixel, counting the work done by generateIntersections
+    void renderTraversalCost(CPUScene& traced, Camera camera, RenderParameter params);
+    // splats the last render into the view of camera, fills history
+    void reproject(Camera camera, RenderParameter params);
+    // linear radiance of a pixel after numSamples samples, including the history
+    glm::vec3 resolve(uint32_t index, uint32_t numSamples) const;
+    // relative standard error of the mean radiance over the image after numSamples samples, negative below two
+    float estimateError(uint32_t numSamples) const;
     CPUScene* scene;
+    // boxes around the models, traced while scene generates in the background
+    std::unique_ptr<CPUScene> preview;
+    // the scene render traces, switched by the generate thread, null until there is something to trace
+    std::atomic<CPUScene*> active = nullptr;
     ThreadPool threadPool;
-    // radiance accumulator
+    // sum of the radiance samples of every pixel, and of their squared luminance when there is a target error
     std::vector<glm::vec3> accumulator;
-    // the thing being displayed
+    std::vector<float> accumulatorSquares;
+    // the thing being displayed, and its linear radiance, every pixel normalized by its own samples
     std::vector<glm::vec3> image;
+    std::vector<glm::vec3> radiance;
+    // radiance of the last finished pass, swapped in by the render thread for writeImage
+    std::vector<glm::vec3> finishedRadiance;
+    glm::uvec2 finishedSize = glm::uvec2(0, 0);
+    mutable std::mutex finishedMutex;
+    // nodes visited and triangles tested per pixel by the last heatmap render
+    std::vector<glm::uvec2> traversalCost;
+    glm::uvec2 traversalCostSize = glm::uvec2(0, 0);
+    // first hit distance of the last sample
+    std::vector<float> depth;
+    // reprojected radiance of the last render, its weight in samples and its distance to the new camera
+    std::vector<glm::vec3> history;
+    std::vector<float> historyWeight;
+    std::vector<float> historyDepth;
+    Camera lastCamera;
+    RenderParameter lastParams;
+    uint32_t completedSamples = 0;
     int width;
     int height;
     GLuint vao;
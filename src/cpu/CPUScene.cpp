@@ -1,75 +1,478 @@
 #include "CPUScene.h"
+#include "util/Packing.h"
+#include "util/Telemetry.h"
+#include "util/Trace.h"
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <iostream>
 #include <numbers>
-#include <ranges>
+#include <numeric>
+#include <utility>
+
+// spread angle of a ray cone after a diffuse bounce, a lobe much wider than any pixel
+static constexpr float DIFFUSE_CONE_SPREAD = 0.25f;
+
+// weight of a sample drawn with pdf when the same direction can also be drawn with otherPdf
+static float powerHeuristic(float pdf, float otherPdf) { return pdf * pdf / (pdf * pdf + otherPdf * otherPdf); }
+
+// decisions of a path that draw their own random numbers, independent of rnd01 and of each other
+enum class RandomStream : uint32_t
+{
+  Environment,
+  Cache,
+  Guide,
+  Count,
+};
+
+// random numbers of a decision at a depth, every depth and stream salts the seed differently
+static glm::vec3 pathRandom(const Payload& payload, uint32_t depth, RandomStream stream)
+{
+  uint32_t salt = (depth * uint32_t(RandomStream::Count) + uint32_t(stream) + 1) * 0x9E3779B9u;
+  return rand01(payload.seed + glm::uvec3(0, 0, salt));
+}
+
+// radiance a path gathered divided by the throughput it had, channels the path could not carry gather nothing
+static glm::vec3 perThroughput(glm::vec3 radiance, glm::vec3 throughput)
+{
+  return glm::vec3(throughput.x > 1e-4f ? radiance.x / throughput.x : 0, throughput.y > 1e-4f ? radiance.y / throughput.y : 0,
+                   throughput.z > 1e-4f ? radiance.z / throughput.z : 0);
+}
+
+
+// object space bounds of the unit shapes, planes get a little thickness so the slab test of the nodes can hit them
+static AABB primitiveBounds(PrimitiveType type)
+{
+  if (type == PrimitiveType::Plane)
+    return AABB{.min = glm::vec3(-1, -1e-4f, -1), .max = glm::vec3(1, 1e-4f, 1)};
+  return AABB{.min = glm::vec3(-1), .max = glm::vec3(1)};
+}
 
 void CPUScene::traceRay(Ray ray, Payload& payload, const float tmin, const float tmax) const noexcept
 {
-  IntersectionInfo info = generateIntersections(hierarchy, ray, tmin, tmax);
+  tracePaths(std::span(&ray, 1), std::span(&payload, 1), tmin, tmax);
+}
 
-  if (info.hitInfo.t < std::numeric_limits<float>::max())
-  {
-    // russian roulette ray termination
-    float p = std::max(std::max(info.brdf.albedo.x, info.brdf.albedo.y), info.brdf.albedo.z);
+void CPUScene::tracePaths(std::span<Ray> rays, std::span<Payload> payloads, const float tmin, const float tmax) const noexcept
+{
+  (this->*getPathTracer(getPathFeatures()))(rays, payloads, tmin, tmax);
+}
 
-    if (payload.depth >= 12)
+uint32_t CPUScene::getPathFeatures(uint32_t optional) const
+{
+  uint32_t features = optional & (ShadowFeature | BounceFeature);
+  if (optional & BounceFeature)
+    features |= optional & (RadianceCacheFeature | GuideFeature);
+  if (!directionalLights.empty())
+    features |= DirectionalLightFeature;
+  if (!pointLights.empty())
+    features |= PointLightFeature;
+  if (environment)
+    features |= EnvironmentFeature;
+  if (std::any_of(cpuMaterials.begin(), cpuMaterials.end(), [](const CPUMaterial& m)
+                  { return m.albedoTexture != TextureCache::INVALID_TEXTURE || m.emissiveTexture != TextureCache::INVALID_TEXTURE; }))
+    features |= TextureFeature;
+  return features;
+}
+
+CPUScene::PathTracer CPUScene::getPathTracer(uint32_t features) const
+{
+  // one instantiation per combination of features, indexed by the feature bits
+  static constexpr auto tracers = []<size_t... F>(std::index_sequence<F...>)
+  { return std::array<PathTracer, sizeof...(F)>{&CPUScene::tracePaths<(uint32_t)F>...}; }(std::make_index_sequence<AllPathFeatures + 1>());
+  return tracers[features & AllPathFeatures];
+}
+
+template <uint32_t Features>
+void CPUScene::tracePaths(std::span<Ray> rays, std::span<Payload> payloads, const float tmin, const float tmax) const noexcept
+{
+  // without bounces the paths end after the direct lighting of the first hit
+  constexpr bool bounces = (Features & BounceFeature) != 0;
+  RayCounters& counters = Telemetry::local();
+  std::vector<IntersectionInfo> hits(rays.size());
+  // paths that have not terminated yet, all of them are at the same depth
+  std::vector<uint32_t> active(rays.size());
+  std::iota(active.begin(), active.end(), 0);
+  // paths that continue past the cache depth to train it, with the radiance and throughput they had there
+  struct CacheSample
+  {
+    uint32_t cell = RadianceCache::INVALID_CELL;
+    glm::vec3 radiance;
+    glm::vec3 throughput;
+  };
+  std::vector<CacheSample> cacheSamples((Features & RadianceCacheFeature) ? rays.size() : 0);
+  // the bounces that train the guide, with the radiance and throughput their path had right after each
+  struct GuideSample
+  {
+    uint32_t path;
+    uint32_t cell;
+    glm::vec3 direction;
+    float pdf;
+    glm::vec3 radiance;
+    glm::vec3 throughput;
+  };
+  // only the bounces that found a cell, the list keeps its capacity from call to call on the same thread
+  thread_local std::vector<GuideSample> guideSamples;
+  guideSamples.clear();
+  for (uint32_t depth = payloads.empty() ? 0 : payloads[0].depth; !active.empty(); ++depth)
+  {
+    counters.add(depth == 0 ? Counter::PrimaryRays : Counter::BounceRays, active.size());
+    uint32_t numActive = 0;
+    for (uint32_t path : active)
     {
-      return;
+      Payload& payload = payloads[path];
+      IntersectionInfo& info = hits[path];
+      info = generateIntersections(hierarchy, rays[path], tmin, tmax);
+      if (depth == 0)
+      {
+        payload.hitDistance = info.hitInfo.t;
+      }
+      if (info.hitInfo.t == std::numeric_limits<float>::max())
+      {
+        if constexpr (Features & EnvironmentFeature)
+        {
+          // the light sample of the last hit may have found the same direction, the two are weighted against each other
+          const Ray& ray = rays[path];
+          float weight = payload.bouncePdf > 0 ? powerHeuristic(payload.bouncePdf, environment->pdf(ray.direction)) : 1.0f;
+          payload.accumulatedRadiance += payload.accumulatedMaterial * environment->evaluate(ray.direction) * weight;
+        }
+        counters.addPath(depth);
+        continue;
+      }
+      if constexpr (Features & TextureFeature)
+      {
+        // the cone footprint grows with distance and with grazing angles
+        payload.coneWidth += payload.coneSpread * info.hitInfo.t;
+        float cosine = std::max(std::abs(glm::dot(info.hitInfo.normal, rays[path].direction)), 1e-4f);
+        info.hitInfo.lod += std::log2(std::max(payload.coneWidth, 1e-8f) / cosine);
+      }
+      active[numActive++] = path;
     }
-    else if (payload.depth > 5)
+    active.resize(numActive);
+
+    // one run per material, each shaded by a single kernel
+    std::sort(active.begin(), active.end(), [&](uint32_t a, uint32_t b) { return hits[a].material < hits[b].material; });
+    for (size_t begin = 0, end = 0; begin < active.size(); begin = end)
     {
-      if (payload.rnd01.z >= p)
-        return;
-      else
-        payload.accumulatedMaterial /= p;
+      while (end < active.size() && hits[active[end]].material == hits[active[begin]].material)
+        end++;
+      shadeHits<(Features & TextureFeature) != 0>(hits[active[begin]].material, std::span(active).subspan(begin, end - begin), hits);
     }
-    // emissive
-    payload.accumulatedRadiance += payload.accumulatedMaterial * info.brdf.emissive * payload.emissive;
-    payload.accumulatedMaterial *= info.brdf.albedo;
 
-    // direct lighting
-    for (const auto& d : directionalLights)
+    // the depth is the same for the whole batch, so the path length checks are made once per bounce
+    bool last = depth >= MAX_PATH_LENGTH;
+    bool roulette = depth > 5;
+    numActive = 0;
+    for (uint32_t path : active)
     {
-      // if there is an intersection, the light is occluded so no lighting
-      if (!testIntersection(hierarchy, Ray(info.hitInfo.position, -d.direction), 1e-4, 1e20))
+      Payload& payload = payloads[path];
+      IntersectionInfo& info = hits[path];
+      Ray& ray = rays[path];
+
+      if (last)
+      {
+        counters.addPath(depth);
+        continue;
+      }
+      if constexpr ((Features & RadianceCacheFeature) != 0)
+      {
+        // the path ends with the cached estimate unless it is one of those that train the cell, or the cell has too few samples
+        if (depth == radianceCache.getDepth())
+        {
+          counters.add(Counter::RadianceCacheLookups);
+          uint32_t cell = radianceCache.findCell(info.hitInfo.position, info.hitInfo.normalLight);
+          glm::vec3 cached;
+          if (cell != RadianceCache::INVALID_CELL && pathRandom(payload, depth, RandomStream::Cache).x >= radianceCache.getUpdateRate() &&
+              radianceCache.lookup(cell, cached))
+          {
+            counters.add(Counter::RadianceCacheHits);
+            payload.accumulatedRadiance += payload.accumulatedMaterial * cached;
+            counters.addPath(depth);
+            continue;
+          }
+          cacheSamples[path] = CacheSample{cell, payload.accumulatedRadiance, payload.accumulatedMaterial};
+        }
+      }
+      if (roulette)
+      {
+        // russian roulette ray termination
+        float p = std::max(std::max(info.brdf.albedo.x, info.brdf.albedo.y), info.brdf.albedo.z);
+        if (payload.rnd01.z >= p)
+        {
+          counters.addPath(depth);
+          continue;
+        }
+        else
+          payload.accumulatedMaterial /= p;
+      }
+      // emissive, only seen directly by the camera
+      if (depth == 0)
+        payload.accumulatedRadiance += payload.accumulatedMaterial * info.brdf.emissive;
+      payload.accumulatedMaterial *= info.brdf.albedo;
+
+      // the guide of the hit is looked up before the light sample, which is weighted against the bounce drawn from it
+      uint32_t guideCell = PathGuide::INVALID_CELL;
+      bool guided = false;
+      if constexpr ((Features & GuideFeature) != 0)
+      {
+        guideCell = pathGuide.findCell(info.hitInfo.position, info.hitInfo.normalLight);
+        guided = guideCell != PathGuide::INVALID_CELL && pathGuide.isTrained(guideCell);
+      }
+      float guideFraction = guided ? pathGuide.getGuideFraction() : 0.0f;
+      // solid angle density of the bounce drawing direction, the cosine lobe mixed with the guide where it is trained
+      auto bouncePdf = [&](glm::vec3 direction, float cosine)
+      {
+        float pdf = cosine / std::numbers::pi_v<float>;
+        return guided ? guideFraction * pathGuide.pdf(guideCell, direction) + (1 - guideFraction) * pdf : pdf;
+      };
+
+      // direct lighting, the shadow rays of all lights start at the hit and are traced together
+      // the environment map is the last light, sampled with a single direction per hit
+      if constexpr (Features & (DirectionalLightFeature | PointLightFeature | EnvironmentFeature))
+      {
+        uint32_t numDirectional = (Features & DirectionalLightFeature) ? (uint32_t)directionalLights.size() : 0;
+        uint32_t numPoint = (Features & PointLightFeature) ? (uint32_t)pointLights.size() : 0;
+        uint32_t numLights = numDirectional + numPoint + ((Features & EnvironmentFeature) ? 1 : 0);
+        glm::vec3 environmentRadiance = glm::vec3(0);
+        float environmentPdf = 0;
+        for (uint32_t first = 0; first < numLights; first += MAX_OCCLUSION_RAYS)
+        {
+          OcclusionQuery query;
+          query.origin = info.hitInfo.position;
+          query.numRays = std::min(numLights - first, MAX_OCCLUSION_RAYS);
+          uint32_t lit = query.numRays == 32 ? ~0u : (1u << query.numRays) - 1;
+          for (uint32_t i = 0; i < query.numRays; ++i)
+          {
+            uint32_t light = first + i;
+            if (light < numDirectional)
+            {
+              query.directions[i] = -directionalLights[light].direction;
+              query.tmax[i] = 1e20f;
+            }
+            else if (light < numDirectional + numPoint)
+            {
+              // point light rays end at the light, their direction spans the whole distance
+              query.directions[i] = pointLights[light - numDirectional].position - info.hitInfo.position;
+              query.tmax[i] = 1.0f;
+            }
+            else
+            {
+              glm::vec2 rnd = glm::vec2(pathRandom(payload, depth, RandomStream::Environment));
+              environmentRadiance = environment->sample(rnd, query.directions[i], environmentPdf);
+              query.tmax[i] = 1e20f;
+              // directions below the surface can't light it
+              if (environmentPdf <= 0 || glm::dot(query.directions[i], info.hitInfo.normalLight) <= 0)
+                lit &= ~(1u << i);
+            }
+          }
+          uint32_t occluded = 0;
+          if constexpr (Features & ShadowFeature)
+          {
+            counters.add(Counter::ShadowRays, std::popcount(lit));
+            occluded = testLightOcclusion(query, first, 1e-4, lit);
+          }
+          for (uint32_t i = 0; i < query.numRays; ++i)
+          {
+            // if there is an intersection, the light is occluded so no lighting
+            if ((occluded & (1u << i)) || !(lit & (1u << i)))
+              continue;
+            uint32_t light = first + i;
+            if (light < numDirectional)
+            {
+              const DirectionalLight& d = directionalLights[light];
+              payload.accumulatedRadiance += info.brdf.evaluate(info.hitInfo, -ray.direction, -d.direction, d.color);
+            }
+            else if (light < numDirectional + numPoint)
+            {
+              const PointLight& p = pointLights[light - numDirectional];
+              glm::vec3 lightDir = query.directions[i];
+              float d = glm::length(lightDir);
+              float illuminance = std::max(1 - d / p.attenuation, 0.0f);
+
+              payload.accumulatedRadiance += illuminance * info.brdf.evaluate(info.hitInfo, -ray.direction, lightDir, p.color);
+            }
+            else
+            {
+              // lambertian, accumulatedMaterial already holds the albedo, the bounce below may find the same direction
+              float cosine = glm::dot(query.directions[i], info.hitInfo.normalLight);
+              float weight = bounces ? powerHeuristic(environmentPdf, bouncePdf(query.directions[i], cosine)) : 1.0f;
+              payload.accumulatedRadiance +=
+                  payload.accumulatedMaterial * environmentRadiance * (cosine / (std::numbers::pi_v<float> * environmentPdf) * weight);
+            }
+          }
+        }
+      }
+
+      // TODO: Next Event Estimation for mesh lights
+
+      if constexpr (!bounces)
+      {
+        counters.addPath(depth);
+        continue;
+      }
+
+      // indirect lighting
+      if constexpr ((Features & GuideFeature) != 0)
+      {
+        // one sample mixture of the guide and the cosine lobe, weighted by the pdf of the mixture
+        // picks the technique and places the guided direction
+        glm::vec3 g = pathRandom(payload, depth, RandomStream::Guide);
+        float guidePdf;
+        glm::vec3 direction = g.x < guideFraction ? pathGuide.sample(guideCell, glm::vec2(g.y, g.z), guidePdf)
+                                                  : sampleHemisphere(info.hitInfo.normalLight, glm::vec2(payload.rnd01));
+        float cosine = glm::dot(direction, info.hitInfo.normalLight);
+        // either technique could have drawn the direction
+        float pdf = bouncePdf(direction, cosine);
+        if (cosine <= 0 || pdf <= 0)
+        {
+          counters.addPath(depth);
+          continue;
+        }
+        // lambertian, accumulatedMaterial already holds the albedo, so a cosine sampled bounce weighs one
+        payload.accumulatedMaterial *= cosine / (std::numbers::pi_v<float> * pdf);
+        ray = Ray(info.hitInfo.position, direction);
+        payload.bouncePdf = pdf;
+        if (guideCell != PathGuide::INVALID_CELL)
+          guideSamples.push_back(GuideSample{path, guideCell, direction, pdf, payload.accumulatedRadiance, payload.accumulatedMaterial});
+      }
+      else
       {
-        payload.accumulatedRadiance += info.brdf.evaluate(info.hitInfo, -ray.direction, -d.direction, d.color);
+        ray = Ray(info.hitInfo.position, sampleHemisphere(info.hitInfo.normalLight, glm::vec2(payload.rnd01)));
+        payload.bouncePdf = std::max(glm::dot(ray.direction, info.hitInfo.normalLight), 0.0f) / std::numbers::pi_v<float>;
       }
+      // a diffuse bounce spreads the cone over the hemisphere, later hits only need coarse mips
+      payload.coneSpread = std::max(payload.coneSpread, DIFFUSE_CONE_SPREAD);
+      payload.depth = depth + 1;
+      active[numActive++] = path;
     }
-    for (const auto& p : pointLights)
+    active.resize(numActive);
+  }
+
+  // every path has ended, what it gathered past the cache depth is a sample of the cell it was in there
+  if constexpr ((Features & RadianceCacheFeature) != 0)
+  {
+    for (size_t path = 0; path < cacheSamples.size(); ++path)
     {
-      glm::vec3 lightDir = p.position - info.hitInfo.position;
-      // if (!testIntersection(hierarchy, Ray(info.hitInfo.position, -lightDir), 1e-4, 1))
-      {
-        float d = glm::length(lightDir);
-        float illuminance = std::max(1 - d / p.attenuation, 0.0f);
+      const CacheSample& sample = cacheSamples[path];
+      if (sample.cell == RadianceCache::INVALID_CELL)
+        continue;
+      // per unit of throughput, so paths arriving through different materials can share the cell
+      glm::vec3 gathered = payloads[path].accumulatedRadiance - sample.radiance;
+      radianceCache.update(sample.cell, perThroughput(gathered, sample.throughput));
+    }
+  }
+  // the same for every bounce, what arrived along its direction trains the guide of the cell it left
+  if constexpr ((Features & GuideFeature) != 0)
+  {
+    for (const GuideSample& sample : guideSamples)
+    {
+      glm::vec3 arrived = payloads[sample.path].accumulatedRadiance - sample.radiance;
+      pathGuide.record(sample.cell, sample.direction, perThroughput(arrived, sample.throughput), sample.pdf);
+    }
+  }
+}
 
-        payload.accumulatedRadiance += illuminance * info.brdf.evaluate(info.hitInfo, -ray.direction, lightDir, p.color);
+template <bool Textured>
+void CPUScene::shadeHits(uint32_t material, std::span<const uint32_t> paths, std::span<IntersectionInfo> hits) const noexcept
+{
+  const CPUMaterial& m = cpuMaterials[material];
+  switch (m.brdf.materialType)
+  {
+  case MaterialType::BlinnPhong:
+    for (uint32_t path : paths)
+    {
+      IntersectionInfo& info = hits[path];
+      info.brdf = m.brdf;
+      if constexpr (Textured)
+      {
+        if (m.albedoTexture != TextureCache::INVALID_TEXTURE)
+          info.brdf.albedo *= textures.sample(m.albedoTexture, info.hitInfo.texCoords, info.hitInfo.lod);
+        if (m.emissiveTexture != TextureCache::INVALID_TEXTURE)
+          info.brdf.emissive *= textures.sample(m.emissiveTexture, info.hitInfo.texCoords, info.hitInfo.lod);
       }
     }
+    break;
+  }
+}
 
-    // TODO: Next Event Estimation for mesh lights
+uint32_t CPUScene::requireTexture(const std::string& filename)
+{
+  if (filename.empty())
+    return TextureCache::INVALID_TEXTURE;
+  auto found = textureIds.find(filename);
+  if (found != textureIds.end())
+    return found->second;
+  // failed loads are remembered as well, the material shades without the texture then
+  uint32_t texture = textures.addTexture(filename);
+  textureIds.emplace(filename, texture);
+  return texture;
+}
 
-    // indirect lighting
-    float r1 = 2 * std::numbers::pi * payload.rnd01.x;
-    float r2 = payload.rnd01.y;
-    float r2s = sqrt(r2);
-    glm::vec3 w = info.hitInfo.normalLight;
-    glm::vec3 u = glm::normalize(glm::cross(std::abs(w.x) > 0.1 ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0), w));
-    glm::vec3 v = glm::cross(w, u);
-    ray = Ray(info.hitInfo.position, glm::normalize(u * cos(r1) * r2s + v * sin(r1) * r2s + w * sqrt(1 - r2)));
-    payload.emissive = 0;
-    payload.depth++;
-    traceRay(ray, payload, tmin, tmax);
+void CPUScene::createMaterials()
+{
+  TRACE_SCOPE("CPUScene::createMaterials");
+  for (size_t i = numCreatedMaterials; i < materials.size(); ++i)
+  {
+    const Material& material = materials[i];
+    cpuMaterials.push_back(CPUMaterial{
+        .brdf =
+            {
+                .albedo = material.albedo,
+                .specularColor = material.specularColor,
+                .shininess = material.shininess,
+                .emissive = material.emissive,
+                .materialType = material.materialType,
+            },
+        .albedoTexture = requireTexture(material.albedoTexture),
+        .emissiveTexture = requireTexture(material.emissiveTexture),
+    });
   }
 }
 
-void CPUScene::createRayTracingHierarchy()
+void CPUScene::createRayTracingHierarchy(ThreadPool& pool)
 {
+  TRACE_SCOPE("createRayTracingHierarchy");
+  // the cached radiance and the guide were gathered in the old scene
+  radianceCache.clear();
+  pathGuide.clear();
+  // only the models added since the last call need a hierarchy
+  uint32_t first = (uint32_t)meshHierarchies.size();
+  meshHierarchies.resize(refs.size());
+  for (size_t i = first; i < refs.size(); ++i)
+  {
+    lazyMeshes.emplace_back();
+  }
+  // the stream is written once, so its models can not wait for the first ray
+  if (!lazyHierarchies || stream)
+  {
+    pool.parallelFor(refs.size() - first, 1,
+                     [&](size_t begin, size_t end)
+                     {
+                       for (size_t i = begin; i < end; ++i)
+                       {
+                         buildMeshHierarchy((uint32_t)(first + i));
+                         lazyMeshes[first + i].ready.store(true, std::memory_order_release);
+                       }
+                     });
+  }
+  if (stream)
+    streamModels();
+
   std::vector<PNode> pendingNodes;
-  for (const auto& [model, ref] : std::views::zip(models, refs))
+  for (uint32_t i = 0; i < instances.size(); ++i)
   {
-    pendingNodes.push_back(std::make_unique<Node>(model->boundingBox, ref));
+    if (refs[instances[i].model].numIndices == 0)
+      continue;
+    AABB aabb = modelBounds[instances[i].model];
+    aabb.transform(instances[i].objectToWorld);
+    pendingNodes.push_back(std::make_unique<Node>(aabb, i));
+  }
+  for (uint32_t i = 0; i < primitives.size(); ++i)
+  {
+    AABB aabb = primitiveBounds(primitives[i].type);
+    aabb.transform(primitives[i].objectToWorld);
+    pendingNodes.push_back(std::make_unique<Node>(aabb, (uint32_t)instances.size() + i));
   }
   while (pendingNodes.size() > 1)
   {
@@ -101,18 +504,27 @@ void CPUScene::createRayTracingHierarchy()
     pendingNodes.erase(pendingNodes.begin() + lhs);
     pendingNodes.push_back(std::move(newNode));
   }
-  hierarchy = std::move(pendingNodes[0]);
+  // an empty scene has no hierarchy at all
+  hierarchy = pendingNodes.empty() ? nullptr : std::move(pendingNodes[0]);
 }
 
 bool CPUScene::testIntersection(const PNode& currentNode, const Ray ray, const float tmin, float tmax) const noexcept
 {
+  // an empty scene has no hierarchy, nothing is hit
+  if (!currentNode)
+    return false;
+  RayCounters& counters = Telemetry::local();
+  counters.add(Counter::AABBTests);
   if (!currentNode->aabb.intersects(ray, tmin, tmax))
   {
     return false;
   }
-  if (currentNode->model.numIndices > 0)
+  counters.add(Counter::NodesVisited);
+  if (currentNode->isLeaf())
   {
-    return testModel(currentNode->model, ray, tmin, tmax);
+    if (currentNode->instance >= instances.size())
+      return testPrimitive(currentNode->instance - (uint32_t)instances.size(), ray, tmin, tmax);
+    return testInstance(instances[currentNode->instance], ray, tmin, tmax);
   }
   auto leftResults = testIntersection(currentNode->left, ray, tmin, tmax);
   auto rightResults = testIntersection(currentNode->right, ray, tmin, tmax);
@@ -120,44 +532,714 @@ bool CPUScene::testIntersection(const PNode& currentNode, const Ray ray, const f
   return leftResults || rightResults;
 }
 
+// bits of the active rays of query that pass through aabb
+static uint32_t intersectBox(const AABB& aabb, const OcclusionQuery& query, const float tmin, uint32_t active)
+{
+  Telemetry::local().add(Counter::AABBTests, std::popcount(active));
+  uint32_t hits = 0;
+  for (uint32_t bits = active; bits != 0; bits &= bits - 1)
+  {
+    uint32_t i = std::countr_zero(bits);
+    if (aabb.intersects(Ray(query.origin, query.directions[i]), tmin, query.tmax[i]))
+      hits |= 1u << i;
+  }
+  return hits;
+}
+
+uint32_t CPUScene::testOcclusion(const PNode& currentNode, const OcclusionQuery& query, const float tmin, uint32_t active,
+                                 Occluder* occluders) const noexcept
+{
+  if (!currentNode)
+    return 0;
+  active = intersectBox(currentNode->aabb, query, tmin, active);
+  if (active == 0)
+  {
+    return 0;
+  }
+  Telemetry::local().add(Counter::NodesVisited);
+  if (currentNode->isLeaf())
+  {
+    if (currentNode->instance >= instances.size())
+      return testPrimitiveOcclusion(currentNode->instance - (uint32_t)instances.size(), query, tmin, active, occluders);
+    return testInstanceOcclusion(currentNode->instance, query, tmin, active, occluders);
+  }
+  uint32_t occluded = testOcclusion(currentNode->left, query, tmin, active, occluders);
+  if (occluded == active)
+    return occluded;
+  return occluded | testOcclusion(currentNode->right, query, tmin, active & ~occluded, occluders);
+}
+
+// last occluder of every light, per thread
+// only a hint, an entry of another scene or one that no longer blocks the light costs a single triangle test
+struct OccluderCache
+{
+  const CPUScene* scene = nullptr;
+  std::vector<Occluder> lights;
+};
+
+uint32_t CPUScene::testLightOcclusion(const OcclusionQuery& query, uint32_t firstLight, const float tmin, uint32_t active) const noexcept
+{
+  thread_local OccluderCache cache;
+  if (cache.scene != this)
+  {
+    cache.scene = this;
+    cache.lights.clear();
+  }
+  if (cache.lights.size() < firstLight + query.numRays)
+    cache.lights.resize(firstLight + query.numRays);
+
+  RayCounters& counters = Telemetry::local();
+  uint32_t occluded = 0;
+  for (uint32_t bits = active; bits != 0; bits &= bits - 1)
+  {
+    uint32_t i = std::countr_zero(bits);
+    const Occluder& occluder = cache.lights[firstLight + i];
+    if (occluder.instance == ~0u)
+      continue;
+    counters.add(Counter::OccluderCacheLookups);
+    if (testOccluder(occluder, Ray(query.origin, query.directions[i]), tmin, query.tmax[i]))
+    {
+      counters.add(Counter::OccluderCacheHits);
+      occluded |= 1u << i;
+    }
+  }
+  if (occluded == active)
+    return occluded;
+
+  Occluder occluders[MAX_OCCLUSION_RAYS];
+  uint32_t traced = testOcclusion(hierarchy, query, tmin, active & ~occluded, occluders);
+  for (uint32_t i = 0; i < query.numRays; ++i)
+  {
+    // a light that is visible keeps its entry, the next ray towards it may well be blocked by the same triangle again
+    if (traced & (1u << i))
+      cache.lights[firstLight + i] = occluders[i];
+  }
+  return occluded | traced;
+}
+
 IntersectionInfo CPUScene::generateIntersections(const PNode& currentNode, const Ray ray, const float tmin, float tmax) const noexcept
 {
-  if (!currentNode->aabb.intersects(ray, tmin, tmax))
+  HitRecord hit;
+  findClosestHit(currentNode, ray, tmin, tmax, hit);
+  return reconstructHit(hit, ray);
+}
+
+void CPUScene::findClosestHit(const PNode& currentNode, const Ray ray, const float tmin, float tmax, HitRecord& hit) const noexcept
+{
+  if (!currentNode)
+    return;
+  RayCounters& counters = Telemetry::local();
+  counters.add(Counter::AABBTests);
+  // subtrees behind the closest hit so far are skipped
+  if (!currentNode->aabb.intersects(ray, tmin, std::min(tmax, hit.t)))
+  {
+    return;
+  }
+  counters.add(Counter::NodesVisited);
+  if (currentNode->isLeaf())
+  {
+    if (currentNode->instance >= instances.size())
+      intersectPrimitive(currentNode->instance - (uint32_t)instances.size(), ray, tmin, tmax, hit);
+    else
+      intersectInstance(currentNode->instance, ray, tmin, tmax, hit);
+    return;
+  }
+  findClosestHit(currentNode->left, ray, tmin, tmax, hit);
+  findClosestHit(currentNode->right, ray, tmin, tmax, hit);
+}
+
+// the direction is not normalized, so distances along the ray are the same in both spaces
+// placement is an InstanceReference or a PrimitiveInstance
+template <typename Placement> static Ray toObjectSpace(const Placement& placement, const Ray& ray)
+{
+  return Ray{
+      .origin = glm::vec3(placement.worldToObject * glm::vec4(ray.origin, 1)),
+      .direction = glm::mat3(placement.worldToObject) * ray.direction,
+  };
+}
+
+// closest distance from tmin to tmax at which the ray enters or leaves a unit shape, the maximum float if there is none
+static float intersectShape(PrimitiveType type, const Ray& ray, const float tmin, const float tmax)
+{
+  Telemetry::local().add(Counter::PrimitiveTests);
+  float t = std::numeric_limits<float>::max();
+  switch (type)
+  {
+  case PrimitiveType::Sphere:
+  {
+    float a = glm::dot(ray.direction, ray.direction);
+    float b = glm::dot(ray.origin, ray.direction);
+    float c = glm::dot(ray.origin, ray.origin) - 1;
+    float discriminant = b * b - a * c;
+    if (discriminant < 0)
+      break;
+    float root = std::sqrt(discriminant);
+    t = (-b - root) / a;
+    if (t < tmin)
+      t = (-b + root) / a;
+    break;
+  }
+  case PrimitiveType::Plane:
   {
+    t = -ray.origin.y / ray.direction.y;
+    glm::vec3 p = ray.origin + ray.direction * t;
+    if (!(std::abs(p.x) <= 1 && std::abs(p.z) <= 1))
+      t = std::numeric_limits<float>::max();
+    break;
+  }
+  case PrimitiveType::Box:
+  {
+    glm::vec3 invD = 1.0f / ray.direction;
+    glm::vec3 t0s = (glm::vec3(-1) - ray.origin) * invD;
+    glm::vec3 t1s = (glm::vec3(1) - ray.origin) * invD;
+    glm::vec3 tsmaller = glm::min(t0s, t1s);
+    glm::vec3 tbigger = glm::max(t0s, t1s);
+    float enter = std::max(tsmaller.x, std::max(tsmaller.y, tsmaller.z));
+    float leave = std::min(tbigger.x, std::min(tbigger.y, tbigger.z));
+    if (enter <= leave)
+      t = enter < tmin ? leave : enter;
+    break;
+  }
+  }
+  return t >= tmin && t <= tmax ? t : std::numeric_limits<float>::max();
+}
+
+bool CPUScene::testPrimitive(uint32_t primitive, const Ray ray, const float tmin, float tmax) const noexcept
+{
+  const PrimitiveInstance& instance = primitives[primitive];
+  return intersectShape(instance.type, toObjectSpace(instance, ray), tmin, tmax) != std::numeric_limits<float>::max();
+}
+
+void CPUScene::intersectPrimitive(uint32_t primitive, const Ray ray, const float tmin, float tmax, HitRecord& hit) const noexcept
+{
+  const PrimitiveInstance& instance = primitives[primitive];
+  float t = intersectShape(instance.type, toObjectSpace(instance, ray), tmin, std::min(tmax, hit.t));
+  if (t < hit.t)
+  {
+    hit.t = t;
+    hit.instance = (uint32_t)instances.size() + primitive;
+    hit.primitive = 0;
+  }
+}
+
+IntersectionInfo CPUScene::reconstructPrimitiveHit(uint32_t primitive, float t, const Ray ray) const noexcept
+{
+  const PrimitiveInstance& instance = primitives[primitive];
+  Ray objectRay = toObjectSpace(instance, ray);
+  glm::vec3 p = objectRay.origin + objectRay.direction * t;
+  glm::vec3 normal = glm::vec3(0, 1, 0);
+  glm::vec2 texCoords = glm::vec2(p.x, p.z) * 0.5f + 0.5f;
+  // texture to object space area ratio of the shape
+  float lod = -1.0f;
+  if (instance.type == PrimitiveType::Sphere)
+  {
+    normal = p;
+    texCoords = glm::vec2(std::atan2(p.z, p.x) / (2 * std::numbers::pi_v<float>) + 0.5f,
+                          std::acos(std::clamp(p.y, -1.0f, 1.0f)) / std::numbers::pi_v<float>);
+    lod = -0.5f * std::log2(4 * std::numbers::pi_v<float>);
+  }
+  else if (instance.type == PrimitiveType::Box)
+  {
+    // the face is the axis the point is furthest out on
+    glm::vec3 a = glm::abs(p);
+    int axis = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+    normal = glm::vec3(0);
+    normal[axis] = p[axis] < 0 ? -1.0f : 1.0f;
+    texCoords = glm::vec2(p[(axis + 1) % 3], p[(axis + 2) % 3]) * 0.5f + 0.5f;
+  }
+  normal = glm::normalize(glm::transpose(glm::mat3(instance.worldToObject)) * normal);
+  return IntersectionInfo{
+      .hitInfo =
+          {
+              .t = t,
+              .position = ray.origin + ray.direction * t,
+              .normal = normal,
+              .normalLight = glm::dot(normal, ray.direction) < 0 ? normal : -normal,
+              .texCoords = texCoords,
+              .lod = lod - std::log2(std::abs(glm::determinant(glm::mat3(instance.objectToWorld)))) / 3.0f,
+          },
+      .material = instance.material,
+  };
+}
+
+bool CPUScene::testInstance(const InstanceReference& instance, const Ray ray, const float tmin, float tmax) const noexcept
+{
+  return testModel(instance.model, toObjectSpace(instance, ray), tmin, tmax);
+}
+
+void CPUScene::intersectInstance(uint32_t instance, const Ray ray, const float tmin, float tmax, HitRecord& hit) const noexcept
+{
+  float closest = hit.t;
+  intersectModel(instances[instance].model, toObjectSpace(instances[instance], ray), tmin, tmax, hit);
+  if (hit.t < closest)
+    hit.instance = instance;
+}
+
+uint32_t CPUScene::testInstanceOcclusion(uint32_t index, const OcclusionQuery& query, const float tmin, uint32_t active,
+                                         Occluder* occluders) const noexcept
+{
+  const InstanceReference& instance = instances[index];
+  OcclusionQuery objectQuery;
+  objectQuery.origin = glm::vec3(instance.worldToObject * glm::vec4(query.origin, 1));
+  objectQuery.numRays = query.numRays;
+  for (uint32_t bits = active; bits != 0; bits &= bits - 1)
+  {
+    uint32_t i = std::countr_zero(bits);
+    objectQuery.directions[i] = glm::mat3(instance.worldToObject) * query.directions[i];
+    objectQuery.tmax[i] = query.tmax[i];
+  }
+  requireHierarchy(instance.model);
+  MeshView mesh = meshView(instance.model);
+  uint32_t occluded = refs[instance.model].hasShortIndices() ? testMeshOcclusion<glm::u16vec3>(mesh, objectQuery, tmin, active, occluders)
+                                                             : testMeshOcclusion<glm::uvec3>(mesh, objectQuery, tmin, active, occluders);
+  if (occluders != nullptr)
+  {
+    for (uint32_t bits = occluded; bits != 0; bits &= bits - 1)
+    {
+      occluders[std::countr_zero(bits)].instance = index;
+    }
+  }
+  return occluded;
+}
+
+uint32_t CPUScene::testPrimitiveOcclusion(uint32_t primitive, const OcclusionQuery& query, const float tmin, uint32_t active,
+                                          Occluder* occluders) const noexcept
+{
+  uint32_t occluded = 0;
+  for (uint32_t bits = active; bits != 0; bits &= bits - 1)
+  {
+    uint32_t i = std::countr_zero(bits);
+    if (!testPrimitive(primitive, Ray(query.origin, query.directions[i]), tmin, query.tmax[i]))
+      continue;
+    occluded |= 1u << i;
+    if (occluders != nullptr)
+      occluders[i] = Occluder{.instance = (uint32_t)instances.size() + primitive};
+  }
+  return occluded;
+}
+
+bool CPUScene::testOccluder(const Occluder& occluder, const Ray ray, const float tmin, float tmax) const noexcept
+{
+  if (occluder.instance >= instances.size() + primitives.size())
+    return false;
+  if (occluder.instance >= instances.size())
+    return testPrimitive(occluder.instance - (uint32_t)instances.size(), ray, tmin, tmax);
+  const InstanceReference& instance = instances[occluder.instance];
+  if (occluder.primitive >= refs[instance.model].numIndices)
+    return false;
+  MeshView mesh = meshView(instance.model);
+  if (refs[instance.model].hasShortIndices())
+    return testTriangles<glm::u16vec3>(mesh, occluder.primitive, occluder.primitive + 1, toObjectSpace(instance, ray), tmin, tmax);
+  return testTriangles<glm::uvec3>(mesh, occluder.primitive, occluder.primitive + 1, toObjectSpace(instance, ray), tmin, tmax);
+}
+
+IntersectionInfo CPUScene::reconstructHit(const HitRecord& hit, const Ray ray) const noexcept
+{
+  if (hit.t == std::numeric_limits<float>::max())
     return {};
+  if (hit.instance >= instances.size())
+    return reconstructPrimitiveHit(hit.instance - (uint32_t)instances.size(), hit.t, ray);
+  const InstanceReference& instance = instances[hit.instance];
+  MeshView mesh = meshView(instance.model);
+  glm::uvec3 triangle = refs[instance.model].hasShortIndices() ? glm::uvec3(((const glm::u16vec3*)mesh.indices)[hit.primitive])
+                                                               : ((const glm::uvec3*)mesh.indices)[hit.primitive];
+  const auto e0 = mesh.positions[triangle.y] - mesh.positions[triangle.x];
+  const auto e1 = mesh.positions[triangle.z] - mesh.positions[triangle.x];
+  const auto texCoords0 = decodeTexCoord(mesh.texCoords[triangle.x]);
+  const auto texCoords1 = decodeTexCoord(mesh.texCoords[triangle.y]);
+  const auto texCoords2 = decodeTexCoord(mesh.texCoords[triangle.z]);
+  const auto uv0 = texCoords1 - texCoords0;
+  const auto uv1 = texCoords2 - texCoords0;
+  float uvArea = std::abs(uv0.x * uv1.y - uv1.x * uv0.y);
+  float area = glm::length(glm::cross(e0, e1));
+
+  // the face normal in object space, moved into world space by the inverse transpose
+  glm::vec3 normal = glm::normalize(glm::transpose(glm::mat3(instance.worldToObject)) * glm::cross(e0, e1));
+  return IntersectionInfo{
+      .hitInfo =
+          {
+              .t = hit.t,
+              .position = ray.origin + ray.direction * hit.t,
+              .normal = normal,
+              .normalLight = glm::dot(normal, ray.direction) < 0 ? normal : -normal,
+              // u and v are the weights of the second and third corner, as intersectTriangles finds them
+              .texCoords = texCoords0 * (1.0f - hit.u - hit.v) + texCoords1 * hit.u + texCoords2 * hit.v,
+              // areas grow with the determinant to the power of 2/3 under uniform scaling
+              .lod = 0.5f * std::log2(uvArea / area) - std::log2(std::abs(glm::determinant(glm::mat3(instance.objectToWorld)))) / 3.0f,
+          },
+      .material = refs[instance.model].material,
+  };
+}
+
+void CPUScene::requireHierarchy(uint32_t model) const noexcept
+{
+  LazyMesh& state = lazyMeshes[model];
+  if (state.ready.load(std::memory_order_acquire))
+    return;
+  std::unique_lock l(state.lock);
+  if (state.ready.load(std::memory_order_relaxed))
+    return;
+  auto start = std::chrono::steady_clock::now();
+  // only touches the hierarchy and the pool ranges of this model, which no other ray reads before ready is set
+  const_cast<CPUScene*>(this)->buildMeshHierarchy(model);
+  state.ready.store(true, std::memory_order_release);
+  RayCounters& counters = Telemetry::local();
+  counters.add(Counter::HierarchyBuilds);
+  counters.add(Counter::HierarchyBuildMicroseconds,
+               std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+void CPUScene::buildMeshHierarchy(uint32_t model)
+{
+  TRACE_SCOPE("buildMeshHierarchy");
+  const ModelReference& reference = refs[model];
+  const glm::vec3* positions = &positionPool[reference.positionOffset];
+  std::vector<AABB> triangleBounds(reference.numIndices);
+  auto computeBounds = [&](const auto* indices)
+  {
+    for (uint32_t i = 0; i < reference.numIndices; ++i)
+    {
+      triangleBounds[i].adjust(positions[indices[i].x]);
+      triangleBounds[i].adjust(positions[indices[i].y]);
+      triangleBounds[i].adjust(positions[indices[i].z]);
+    }
+  };
+  if (reference.hasShortIndices())
+    computeBounds(shortIndicesPool.data() + reference.indicesOffset);
+  else
+    computeBounds(indicesPool.data() + reference.indicesOffset);
+
+  std::vector<uint32_t> order;
+  meshHierarchies[model] = MeshBVH::build(triangleBounds, order);
+  if (reference.hasShortIndices())
+    reorderModel(reference, shortIndicesPool.data() + reference.indicesOffset, order);
+  else
+    reorderModel(reference, indicesPool.data() + reference.indicesOffset, order);
+}
+
+template <typename T> static void permute(T* values, const std::vector<uint32_t>& remap)
+{
+  std::vector<T> permuted(remap.size());
+  for (size_t i = 0; i < remap.size(); ++i)
+  {
+    permuted[remap[i]] = values[i];
+  }
+  std::copy(permuted.begin(), permuted.end(), values);
+}
+
+template <typename Index> void CPUScene::reorderModel(const ModelReference& reference, Index* indices, const std::vector<uint32_t>& order)
+{
+  // triangles in leaf order, vertices numbered by their first use so a leaf touches a contiguous range of them
+  std::vector<Index> triangles(reference.numIndices);
+  std::vector<uint32_t> remap(reference.numPositions, std::numeric_limits<uint32_t>::max());
+  uint32_t numUsed = 0;
+  for (uint32_t i = 0; i < reference.numIndices; ++i)
+  {
+    Index triangle = indices[order[i]];
+    for (int c = 0; c < 3; ++c)
+    {
+      uint32_t& vertex = remap[triangle[c]];
+      if (vertex == std::numeric_limits<uint32_t>::max())
+        vertex = numUsed++;
+      triangle[c] = (typename Index::value_type)vertex;
+    }
+    triangles[i] = triangle;
+  }
+  for (auto& vertex : remap)
+  {
+    if (vertex == std::numeric_limits<uint32_t>::max())
+      vertex = numUsed++;
+  }
+  std::copy(triangles.begin(), triangles.end(), indices);
+  permute(&positionPool[reference.positionOffset], remap);
+  permute(&texCoordsPool[reference.positionOffset], remap);
+  permute(&normalsPool[reference.positionOffset], remap);
+}
+
+void CPUScene::setGeometryStreaming(std::string_view cacheFile, uint64_t budgetBytes)
+{
+  stream = std::make_unique<GeometryStream>(cacheFile, budgetBytes);
+}
+
+void CPUScene::streamModels()
+{
+  TRACE_SCOPE("CPUScene::streamModels");
+  std::vector<MeshData> meshes;
+  for (uint32_t i = stream->getNumModels(); i < refs.size(); ++i)
+  {
+    const ModelReference& reference = refs[i];
+    const std::byte* indices = reference.hasShortIndices() ? (const std::byte*)(shortIndicesPool.data() + reference.indicesOffset)
+                                                           : (const std::byte*)(indicesPool.data() + reference.indicesOffset);
+    meshes.push_back(MeshData{
+        .positions = std::span(positionPool).subspan(reference.positionOffset, reference.numPositions),
+        .texCoords = std::span(texCoordsPool).subspan(reference.positionOffset, reference.numPositions),
+        .normals = std::span(normalsPool).subspan(reference.positionOffset, reference.numPositions),
+        .indices = std::span(indices, reference.numIndices * (reference.hasShortIndices() ? sizeof(glm::u16vec3) : sizeof(glm::uvec3))),
+        .nodes = meshHierarchies[i],
+    });
+  }
+  if (!stream->append(meshes))
+  {
+    // the models stay in memory
+    std::cout << "Could not stream the scene geometry" << std::endl;
+    stream.reset();
+    return;
+  }
+  // the next generate starts the pools over, its models are streamed as well
+  positionPool = {};
+  texCoordsPool = {};
+  normalsPool = {};
+  shortIndicesPool = {};
+  indicesPool = {};
+  for (auto& nodes : meshHierarchies)
+  {
+    nodes = {};
   }
-  if (currentNode->model.numIndices > 0)
+}
+
+MeshView CPUScene::meshView(uint32_t model) const
+{
+  if (stream && model < stream->getNumModels())
+    return stream->view(model);
+  const ModelReference& reference = refs[model];
+  return MeshView{
+      .positions = positionPool.data() + reference.positionOffset,
+      .texCoords = texCoordsPool.data() + reference.positionOffset,
+      .normals = normalsPool.data() + reference.positionOffset,
+      .indices = reference.hasShortIndices() ? (const void*)(shortIndicesPool.data() + reference.indicesOffset)
+                                             : (const void*)(indicesPool.data() + reference.indicesOffset),
+      .nodes = meshHierarchies[model].data(),
+  };
+}
+
+void CPUScene::prefetchVisible(const Camera& camera, glm::uvec2 dims) const
+{
+  if (!stream)
+    return;
+  TRACE_SCOPE("CPUScene::prefetchVisible");
+  for (const InstanceReference& instance : instances)
   {
-    return intersectModel(currentNode->model, ray, tmin, tmax);
+    if (refs[instance.model].numIndices == 0 || instance.model >= stream->getNumModels())
+      continue;
+    // conservative, an instance counts as visible if its projected bounds overlap the image or it reaches behind the camera
+    const AABB& bounds = modelBounds[instance.model];
+    glm::ivec2 lower = glm::ivec2(std::numeric_limits<int>::max());
+    glm::ivec2 upper = glm::ivec2(std::numeric_limits<int>::min());
+    bool visible = false;
+    for (int corner = 0; corner < 8 && !visible; ++corner)
+    {
+      glm::vec3 local = glm::vec3(corner & 1 ? bounds.max.x : bounds.min.x, corner & 2 ? bounds.max.y : bounds.min.y,
+                                  corner & 4 ? bounds.max.z : bounds.min.z);
+      glm::ivec2 pix;
+      if (!camera.project(glm::vec3(instance.objectToWorld * glm::vec4(local, 1)), dims, pix))
+        visible = true;
+      lower = glm::min(lower, pix);
+      upper = glm::max(upper, pix);
+    }
+    if (visible || (upper.x >= 0 && upper.y >= 0 && lower.x < (int)dims.x && lower.y < (int)dims.y))
+      stream->prefetch(instance.model);
   }
-  auto leftResult = generateIntersections(currentNode->left, ray, tmin, tmax);
-  auto rightResult = generateIntersections(currentNode->right, ray, tmin, tmax);
+}
 
-  return leftResult.hitInfo.t < rightResult.hitInfo.t ? leftResult : rightResult;
+void CPUScene::trimCaches()
+{
+  if (stream)
+    stream->trim();
+  textures.trim();
+  if (radianceCache.getNumUsedCells() > 0)
+    radianceCache.resolve();
+  if (pathGuide.getNumUsedCells() > 0)
+    pathGuide.resolve();
+}
+
+GeometryMemory CPUScene::getGeometryMemory() const
+{
+  GeometryMemory memory = Scene::getGeometryMemory();
+  if (stream)
+    memory.residentBytes = stream->getResidentBytes();
+  return memory;
 }
 
-bool CPUScene::testModel(const ModelReference& reference, const Ray ray, const float tmin, float tmax) const noexcept
+bool CPUScene::testModel(uint32_t model, const Ray ray, const float tmin, float tmax) const noexcept
 {
-  float distance = 0;
+  requireHierarchy(model);
+  MeshView mesh = meshView(model);
+  if (refs[model].hasShortIndices())
+    return testMesh<glm::u16vec3>(mesh, ray, tmin, tmax);
+  return testMesh<glm::uvec3>(mesh, ray, tmin, tmax);
+}
+
+void CPUScene::intersectModel(uint32_t model, const Ray ray, const float tmin, float tmax, HitRecord& hit) const noexcept
+{
+  requireHierarchy(model);
+  MeshView mesh = meshView(model);
+  if (refs[model].hasShortIndices())
+    intersectMesh<glm::u16vec3>(mesh, ray, tmin, tmax, hit);
+  else
+    intersectMesh<glm::uvec3>(mesh, ray, tmin, tmax, hit);
+}
+
+template <typename Index> bool CPUScene::testMesh(const MeshView& mesh, const Ray ray, const float tmin, float tmax) const noexcept
+{
+  RayCounters& counters = Telemetry::local();
+  uint32_t stack[MeshBVH::MAX_DEPTH];
+  uint32_t stackSize = 0;
+  uint32_t current = 0;
+  while (true)
+  {
+    const MeshNode& node = mesh.nodes[current];
+    counters.add(Counter::AABBTests);
+    if (node.aabb.intersects(ray, tmin, tmax))
+    {
+      counters.add(Counter::NodesVisited);
+      if (!node.isLeaf())
+      {
+        stack[stackSize++] = node.offset;
+        current++;
+        continue;
+      }
+      if (testTriangles<Index>(mesh, node.offset, node.offset + node.count, ray, tmin, tmax))
+        return true;
+    }
+    if (stackSize == 0)
+      return false;
+    current = stack[--stackSize];
+  }
+}
+
+template <typename Index>
+uint32_t CPUScene::testMeshOcclusion(const MeshView& mesh, const OcclusionQuery& query, const float tmin, uint32_t active,
+                                     Occluder* occluders) const noexcept
+{
+  struct Entry
+  {
+    uint32_t node;
+    // rays that entered the parent, the node is tested with those not occluded meanwhile
+    uint32_t active;
+  };
+  Entry stack[MeshBVH::MAX_DEPTH];
+  uint32_t stackSize = 0;
+  uint32_t current = 0;
+  uint32_t entering = active;
+  uint32_t occluded = 0;
+  while (true)
+  {
+    const MeshNode& node = mesh.nodes[current];
+    uint32_t hits = intersectBox(node.aabb, query, tmin, entering & ~occluded);
+    if (hits != 0)
+    {
+      Telemetry::local().add(Counter::NodesVisited);
+      if (!node.isLeaf())
+      {
+        stack[stackSize++] = Entry{node.offset, hits};
+        current++;
+        entering = hits;
+        continue;
+      }
+      occluded |= testTrianglesOcclusion<Index>(mesh, node.offset, node.offset + node.count, query, tmin, hits, occluders);
+      if (occluded == active)
+        return occluded;
+    }
+    if (stackSize == 0)
+      return occluded;
+    current = stack[--stackSize].node;
+    entering = stack[stackSize].active;
+  }
+}
 
-  for (size_t posIndex = 0, edgeIndex = 0, normalIndex = 0; posIndex < reference.numIndices; posIndex++, edgeIndex += 2, normalIndex++)
+template <typename Index>
+uint32_t CPUScene::testTrianglesOcclusion(const MeshView& mesh, uint32_t begin, uint32_t end, const OcclusionQuery& query,
+                                          const float tmin, uint32_t active, Occluder* occluders) const noexcept
+{
+  const glm::vec3* positions = mesh.positions;
+  const Index* indices = (const Index*)mesh.indices;
+  uint32_t occluded = 0;
+  size_t posIndex = begin;
+  for (; posIndex < end && occluded != active; posIndex++)
   {
-    const auto i0 = indicesPool[reference.indicesOffset + posIndex].x;
-    const auto i1 = indicesPool[reference.indicesOffset + posIndex].y;
-    const auto i2 = indicesPool[reference.indicesOffset + posIndex].z;
+    const auto& p0 = positions[indices[posIndex].x];
+    const auto& p1 = positions[indices[posIndex].y];
+    const auto& p2 = positions[indices[posIndex].z];
+
+    const auto e0 = p1 - p0;
+    const auto e1 = p2 - p0;
+
+    // the terms that only depend on the origin are shared by all rays
+    const auto s = query.origin - p0;
+    const auto s2 = glm::cross(s, e0);
+
+    for (uint32_t bits = active & ~occluded; bits != 0; bits &= bits - 1)
+    {
+      uint32_t i = std::countr_zero(bits);
+      const glm::vec3& direction = query.directions[i];
+      const auto s1 = glm::cross(direction, e1);
 
-    const auto& p0 = positionPool[reference.positionOffset + i0];
-    const auto& p1 = positionPool[reference.positionOffset + i1];
-    const auto& p2 = positionPool[reference.positionOffset + i2];
+      const float fraction = 1.0f / glm::dot(s1, e0);
+      const auto resultVector = glm::vec3(glm::dot(s2, e1), glm::dot(s1, s), glm::dot(s2, direction)) * fraction;
 
-    const auto& t0 = texCoordsPool[reference.positionOffset + i0];
-    const auto& t1 = texCoordsPool[reference.positionOffset + i1];
-    const auto& t2 = texCoordsPool[reference.positionOffset + i2];
+      const float b3 = 1.0f - resultVector.y - resultVector.z;
 
-    const auto& e0 = edgesPool[reference.indicesOffset + edgeIndex];
-    const auto& e1 = edgesPool[reference.indicesOffset + edgeIndex + 1];
+      if (b3 < 0 || b3 > 1)
+        continue;
+      if (resultVector.y < 0 || resultVector.y > 1)
+        continue;
+      if (resultVector.z < 0 || resultVector.z > 1)
+        continue;
 
-    const auto& n = faceNormalsPool[reference.indicesOffset + normalIndex];
+      if (resultVector.x < tmin || resultVector.x > query.tmax[i])
+        continue;
+      occluded |= 1u << i;
+      if (occluders != nullptr)
+        occluders[i].primitive = (uint32_t)posIndex;
+    }
+  }
+
+  Telemetry::local().add(Counter::TriangleTests, (posIndex - begin) * std::popcount(active));
+  return occluded;
+}
+
+template <typename Index>
+void CPUScene::intersectMesh(const MeshView& mesh, const Ray ray, const float tmin, float tmax, HitRecord& hit) const noexcept
+{
+  RayCounters& counters = Telemetry::local();
+  uint32_t stack[MeshBVH::MAX_DEPTH];
+  uint32_t stackSize = 0;
+  uint32_t current = 0;
+  while (true)
+  {
+    const MeshNode& node = mesh.nodes[current];
+    counters.add(Counter::AABBTests);
+    // nodes behind the closest hit so far are skipped
+    if (node.aabb.intersects(ray, tmin, std::min(tmax, hit.t)))
+    {
+      counters.add(Counter::NodesVisited);
+      if (!node.isLeaf())
+      {
+        stack[stackSize++] = node.offset;
+        current++;
+        continue;
+      }
+      intersectTriangles<Index>(mesh, node.offset, node.offset + node.count, ray, tmin, tmax, hit);
+    }
+    if (stackSize == 0)
+      return;
+    current = stack[--stackSize];
+  }
+}
+
+template <typename Index>
+bool CPUScene::testTriangles(const MeshView& mesh, uint32_t begin, uint32_t end, const Ray ray, const float tmin, float tmax) const noexcept
+{
+  const glm::vec3* positions = mesh.positions;
+  const Index* indices = (const Index*)mesh.indices;
+  for (size_t posIndex = begin; posIndex < end; posIndex++)
+  {
+    const auto& p0 = positions[indices[posIndex].x];
+    const auto& p1 = positions[indices[posIndex].y];
+    const auto& p2 = positions[indices[posIndex].z];
+
+    const auto e0 = p1 - p0;
+    const auto e1 = p2 - p0;
 
     const auto s = ray.origin - p0;
     const auto s1 = glm::cross(ray.direction, e1);
@@ -168,8 +1250,6 @@ bool CPUScene::testModel(const ModelReference& reference, const Ray ray, const f
 
     const float b3 = 1.0f - resultVector.y - resultVector.z;
 
-    const auto texCoords = t0 * resultVector.y + t1 * resultVector.z + t2 * b3;
-
     if (b3 < 0 || b3 > 1)
       continue;
     if (resultVector.y < 0 || resultVector.y > 1)
@@ -179,33 +1259,29 @@ bool CPUScene::testModel(const ModelReference& reference, const Ray ray, const f
 
     if (resultVector.x < tmin || resultVector.x > tmax)
       continue;
+    Telemetry::local().add(Counter::TriangleTests, posIndex - begin + 1);
     return true;
   }
 
+  Telemetry::local().add(Counter::TriangleTests, end - begin);
   return false;
 }
-IntersectionInfo CPUScene::intersectModel(const ModelReference& reference, const Ray ray, const float tmin, float tmax) const noexcept
+
+template <typename Index>
+void CPUScene::intersectTriangles(const MeshView& mesh, uint32_t begin, uint32_t end, const Ray ray, const float tmin, float tmax,
+                                  HitRecord& hit) const noexcept
 {
-  IntersectionInfo intersection = {};
+  const glm::vec3* positions = mesh.positions;
+  const Index* indices = (const Index*)mesh.indices;
 
-  for (size_t posIndex = 0, edgeIndex = 0, normalIndex = 0; posIndex < reference.numIndices; posIndex++, edgeIndex += 2, normalIndex++)
+  for (size_t posIndex = begin; posIndex < end; posIndex++)
   {
-    const auto i0 = indicesPool[reference.indicesOffset + posIndex].x;
-    const auto i1 = indicesPool[reference.indicesOffset + posIndex].y;
-    const auto i2 = indicesPool[reference.indicesOffset + posIndex].z;
+    const auto& p0 = positions[indices[posIndex].x];
+    const auto& p1 = positions[indices[posIndex].y];
+    const auto& p2 = positions[indices[posIndex].z];
 
-    const auto& p0 = positionPool[reference.positionOffset + i0];
-    const auto& p1 = positionPool[reference.positionOffset + i1];
-    const auto& p2 = positionPool[reference.positionOffset + i2];
-
-    const auto& t0 = texCoordsPool[reference.positionOffset + i0];
-    const auto& t1 = texCoordsPool[reference.positionOffset + i1];
-    const auto& t2 = texCoordsPool[reference.positionOffset + i2];
-
-    const auto& e0 = edgesPool[reference.indicesOffset + edgeIndex];
-    const auto& e1 = edgesPool[reference.indicesOffset + edgeIndex + 1];
-
-    const auto& n = faceNormalsPool[reference.indicesOffset + normalIndex];
+    const auto e0 = p1 - p0;
+    const auto e1 = p2 - p0;
 
     const auto s = ray.origin - p0;
     const auto s1 = glm::cross(ray.direction, e1);
@@ -216,8 +1292,6 @@ IntersectionInfo CPUScene::intersectModel(const ModelReference& reference, const
 
     const float b3 = 1.0f - resultVector.y - resultVector.z;
 
-    const auto texCoords = t0 * resultVector.y + t1 * resultVector.z + t2 * b3;
-
     if (b3 < 0 || b3 > 1)
       continue;
     if (resultVector.y < 0 || resultVector.y > 1)
@@ -228,25 +1302,15 @@ IntersectionInfo CPUScene::intersectModel(const ModelReference& reference, const
     if (resultVector.x < tmin || resultVector.x > tmax)
       continue;
 
-    if (intersection.hitInfo.t < resultVector.x)
+    if (hit.t < resultVector.x)
       continue;
 
-    intersection = IntersectionInfo{
-        .hitInfo =
-            {
-                .t = resultVector.x,
-                .position = ray.origin + ray.direction * resultVector.x,
-                .normal = n,
-                .normalLight = glm::dot(n, ray.direction) < 0 ? n : -n,
-                .texCoords = texCoords,
-            },
-        .brdf =
-            {
-                .albedo = glm::vec3(0, 1, 0.0f),
-                .emissive = glm::vec3(0.0f, 0.0f, 0.0f),
-            },
-    };
+    // the surface is only reconstructed for the closest hit, after the traversal
+    hit.t = resultVector.x;
+    hit.primitive = (uint32_t)posIndex;
+    hit.u = resultVector.y;
+    hit.v = resultVector.z;
   }
 
-  return intersection;
+  Telemetry::local().add(Counter::TriangleTests, end - begin);
 }
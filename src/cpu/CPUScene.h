@@ -1,26 +1,198 @@
 #pragma once
+#include "GeometryStream.h"
+#include "MeshBVH.h"
+#include "PathGuide.h"
+#include "RadianceCache.h"
 #include "scene/Scene.h"
+#include "util/Camera.h"
+#include "util/TextureCache.h"
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+
+// closest hit found so far by a traversal, the surface of the final one is reconstructed by CPUScene::reconstructHit
+struct HitRecord
+{
+  float t = std::numeric_limits<float>::max();
+  // triangle within the model of the instance
+  uint32_t primitive = 0;
+  // instances are followed by the analytic primitives of the scene
+  uint32_t instance = 0;
+  // barycentric coordinates of the hit as found by the triangle test
+  float u = 0;
+  float v = 0;
+};
+
+// most shadow rays a single occlusion query can hold, one bit of a mask each
+static constexpr uint32_t MAX_OCCLUSION_RAYS = 32;
+
+// rays with a shared origin, tested together in one traversal by CPUScene::testOcclusion
+struct OcclusionQuery
+{
+  glm::vec3 origin;
+  uint32_t numRays = 0;
+  // not normalized, ray i is occluded by hits from tmin up to tmax[i] in units of directions[i]
+  glm::vec3 directions[MAX_OCCLUSION_RAYS];
+  float tmax[MAX_OCCLUSION_RAYS];
+};
+
+// triangle or analytic primitive that blocked a shadow ray
+struct Occluder
+{
+  // as in HitRecord
+  uint32_t instance = ~0u;
+  uint32_t primitive = 0;
+};
 
 class CPUScene : public Scene {
 public:
     CPUScene(){}
     virtual ~CPUScene(){}
     void traceRay(Ray ray, Payload& payload, const float tmin, const float tmax) const noexcept;
-    virtual void createRayTracingHierarchy() override;
+    // traces the paths of all rays one bounce at a time, the hits of a bounce are sorted by material
+    // so every material is shaded for all of its hits at once, rays ends up holding the last ray of each path
+    // all payloads have to start at the same depth
+    void tracePaths(std::span<Ray> rays, std::span<Payload> payloads, const float tmin, const float tmax) const noexcept;
+    // what an integrator variant handles, features a scene does not use are compiled out of its inner loop
+    enum PathFeature : uint32_t
+    {
+      DirectionalLightFeature = 1 << 0,
+      PointLightFeature = 1 << 1,
+      ShadowFeature = 1 << 2,
+      BounceFeature = 1 << 3,
+      TextureFeature = 1 << 4,
+      EnvironmentFeature = 1 << 5,
+      // paths end at the depth of radianceCache with its estimate, only with bounces
+      RadianceCacheFeature = 1 << 6,
+      // bounces sample pathGuide next to the cosine lobe and train it, only with bounces
+      GuideFeature = 1 << 7,
+      AllPathFeatures = (1 << 8) - 1,
+    };
+    using PathTracer = void (CPUScene::*)(std::span<Ray>, std::span<Payload>, const float, const float) const noexcept;
+    // the features the current lights and materials need, plus those of optional that were asked for
+    // optional holds ShadowFeature, BounceFeature, RadianceCacheFeature and GuideFeature, the last two only apply with bounces
+    uint32_t getPathFeatures(uint32_t optional = ShadowFeature | BounceFeature) const;
+    // tracePaths specialized for features, chosen once per render instead of branching per ray
+    PathTracer getPathTracer(uint32_t features) const;
+    template <uint32_t Features>
+    void tracePaths(std::span<Ray> rays, std::span<Payload> payloads, const float tmin, const float tmax) const noexcept;
+    virtual void createRayTracingHierarchy(ThreadPool& pool) override;
+    virtual GeometryMemory getGeometryMemory() const override;
+    // moves the bottom level geometry of all models to cacheFile from the next generate on,
+    // keeping about budgetBytes of it in memory
+    void setGeometryStreaming(std::string_view cacheFile, uint64_t budgetBytes);
+    // builds the hierarchy of a model the first time a ray reaches one of its instances instead of in generate,
+    // on by default, streamed models are always built up front
+    void setLazyHierarchies(bool lazy) { lazyHierarchies = lazy; }
+    // hints the stream to read the models whose instances may be seen by camera
+    void prefetchVisible(const Camera& camera, glm::uvec2 dims) const;
+    // between passes, evicts streamed models and texture tiles that were not used recently
+    // and adds the samples of the pass to the radiance cache and the path guide
+    void trimCaches();
     DECLARE_REF(Node)
     struct Node
     {
       PNode left;
       PNode right;
       AABB aabb;
-      ModelReference model;
+      // index into instances, or into primitives after the last instance, only meaningful for leaves
+      uint32_t instance = 0;
       Node(AABB aabb) : aabb(aabb) {}
-      Node(AABB aabb, ModelReference model) : aabb(aabb), model(model) {}
+      Node(AABB aabb, uint32_t instance) : aabb(aabb), instance(instance) {}
+      bool isLeaf() const { return left == nullptr; }
     };
     PNode hierarchy;
     // tests if a ray intersects any geometry, no hit information, for shadow rays
     bool testIntersection(const PNode& currentNode, const Ray ray, const float tmin, const float tmax) const noexcept;
+    // tests the rays of query whose bits are set in active, returns the bits of the occluded ones
+    // the nodes are visited once for all rays, rays are dropped from the traversal as soon as they are occluded
+    // occluders, if given, receives the triangle that blocked each occluded ray
+    uint32_t testOcclusion(const PNode& currentNode, const OcclusionQuery& query, const float tmin, uint32_t active,
+                           Occluder* occluders = nullptr) const noexcept;
+    // testOcclusion for shadow rays towards the lights firstLight and on, directional lights first, then point lights
+    // each ray first tests the triangle that last blocked the light on this thread, most neighbouring rays share it
+    uint32_t testLightOcclusion(const OcclusionQuery& query, uint32_t firstLight, const float tmin, uint32_t active) const noexcept;
     IntersectionInfo generateIntersections(const PNode& currentNode, const Ray ray, const float tmin, const float tmax) const noexcept;
-    bool testModel(const ModelReference& reference, const Ray ray, const float tmin, const float tmax) const noexcept;
-    IntersectionInfo intersectModel(const ModelReference& reference, const Ray ray, const float tmin, const float tmax) const noexcept;
+    // the traversal only carries the hit record, hit is updated when a closer one is found
+    void findClosestHit(const PNode& currentNode, const Ray ray, const float tmin, const float tmax, HitRecord& hit) const noexcept;
+    // position, normal, texture coordinates and material of a hit in world space, ray is the one that was traced
+    IntersectionInfo reconstructHit(const HitRecord& hit, const Ray ray) const noexcept;
+    // the instance functions move the ray into object space
+    bool testInstance(const InstanceReference& instance, const Ray ray, const float tmin, const float tmax) const noexcept;
+    void intersectInstance(uint32_t instance, const Ray ray, const float tmin, const float tmax, HitRecord& hit) const noexcept;
+    bool testModel(uint32_t model, const Ray ray, const float tmin, const float tmax) const noexcept;
+    void intersectModel(uint32_t model, const Ray ray, const float tmin, const float tmax, HitRecord& hit) const noexcept;
+    // closed form tests of the analytic primitives, hits are recorded with the instance after the last one in instances
+    bool testPrimitive(uint32_t primitive, const Ray ray, const float tmin, const float tmax) const noexcept;
+    void intersectPrimitive(uint32_t primitive, const Ray ray, const float tmin, const float tmax, HitRecord& hit) const noexcept;
+    // bottom level hierarchy of every model in refs, empty for the models in stream
+    std::vector<std::vector<MeshNode>> meshHierarchies;
+    std::unique_ptr<GeometryStream> stream;
+    // shared by all workers, sampled by the materials
+    TextureCache textures;
+    // trained and read by the RadianceCacheFeature variants, cleared by generate
+    RadianceCache radianceCache;
+    // trained and sampled by the GuideFeature variants, cleared by generate
+    PathGuide pathGuide;
+    bool lazyHierarchies = true;
+
+private:
+    // a material of the scene with its textures in the cache
+    struct CPUMaterial
+    {
+      BRDF brdf;
+      uint32_t albedoTexture = TextureCache::INVALID_TEXTURE;
+      uint32_t emissiveTexture = TextureCache::INVALID_TEXTURE;
+    };
+    // indexed like materials
+    std::vector<CPUMaterial> cpuMaterials;
+    // texture files already in the cache, shared by the materials that use them
+    std::unordered_map<std::string, uint32_t> textureIds;
+    virtual void createMaterials() override;
+    uint32_t requireTexture(const std::string& filename);
+    // fills the brdf of the hits of the paths, all of which hit material
+    template <bool Textured>
+    void shadeHits(uint32_t material, std::span<const uint32_t> paths, std::span<IntersectionInfo> hits) const noexcept;
+    // build state of a bottom level hierarchy, ready is set once meshHierarchies and the pool ranges of the model are final
+    struct LazyMesh
+    {
+      std::atomic<bool> ready = false;
+      std::mutex lock;
+    };
+    // a deque so the states never move while rays are in flight
+    mutable std::deque<LazyMesh> lazyMeshes;
+    // builds the hierarchy of model if no other ray did so before, the first ray waits for it
+    void requireHierarchy(uint32_t model) const noexcept;
+    // builds the hierarchy of a model and reorders its triangles and vertices to match the leaves
+    void buildMeshHierarchy(uint32_t model);
+    template <typename Index> void reorderModel(const ModelReference& reference, Index* indices, const std::vector<uint32_t>& order);
+    // writes the models not in stream yet to it and releases the pools
+    void streamModels();
+    // geometry of a model, wherever it lives
+    MeshView meshView(uint32_t model) const;
+    uint32_t testPrimitiveOcclusion(uint32_t primitive, const OcclusionQuery& query, const float tmin, uint32_t active,
+                                    Occluder* occluders) const noexcept;
+    IntersectionInfo reconstructPrimitiveHit(uint32_t primitive, float t, const Ray ray) const noexcept;
+    uint32_t testInstanceOcclusion(uint32_t instance, const OcclusionQuery& query, const float tmin, uint32_t active,
+                                   Occluder* occluders) const noexcept;
+    template <typename Index>
+    uint32_t testMeshOcclusion(const MeshView& mesh, const OcclusionQuery& query, const float tmin, uint32_t active,
+                               Occluder* occluders) const noexcept;
+    template <typename Index>
+    uint32_t testTrianglesOcclusion(const MeshView& mesh, uint32_t begin, uint32_t end, const OcclusionQuery& query, const float tmin,
+                                    uint32_t active, Occluder* occluders) const noexcept;
+    // a single ray against a single triangle, for the occluder cache
+    bool testOccluder(const Occluder& occluder, const Ray ray, const float tmin, const float tmax) const noexcept;
+    template <typename Index> bool testMesh(const MeshView& mesh, const Ray ray, const float tmin, const float tmax) const noexcept;
+    template <typename Index>
+    void intersectMesh(const MeshView& mesh, const Ray ray, const float tmin, const float tmax, HitRecord& hit) const noexcept;
+    // edges and face normals are derived from the positions, the pools only hold vertices and indices
+    template <typename Index>
+    bool testTriangles(const MeshView& mesh, uint32_t begin, uint32_t end, const Ray ray, const float tmin, const float tmax) const noexcept;
+    template <typename Index>
+    void intersectTriangles(const MeshView& mesh, uint32_t begin, uint32_t end, const Ray ray, const float tmin, const float tmax,
+                            HitRecord& hit) const noexcept;
 };
\ No newline at end of file
@@ -0,0 +1,118 @@
+#include "GeometryStream.h"
+#include "util/Trace.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+// sections start at a multiple of this, enough for the vector loads of the traversal
+static constexpr uint64_t SECTION_ALIGNMENT = 64;
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment) { return (value + alignment - 1) / alignment * alignment; }
+
+GeometryStream::GeometryStream(std::string_view filename, uint64_t budget) : filename(filename), budget(budget) {}
+
+bool GeometryStream::append(std::span<const MeshData> meshes)
+{
+  TRACE_SCOPE("GeometryStream::append");
+  // blocks start on a page so evicting one model never drops the pages of its neighbours
+  uint64_t pageSize = MappedFile::pageSize();
+  file.reset();
+  std::ofstream out(filename, std::ios::binary | (blocks.empty() ? std::ios::trunc : std::ios::app));
+  if (!out)
+  {
+    std::cout << "Could not open " << filename << std::endl;
+    return false;
+  }
+  const char padding[SECTION_ALIGNMENT] = {};
+  auto write = [&](const void* data, uint64_t size, uint64_t alignment)
+  {
+    uint64_t start = alignUp(fileSize, alignment);
+    while (fileSize < start)
+    {
+      uint64_t n = std::min<uint64_t>(start - fileSize, SECTION_ALIGNMENT);
+      out.write(padding, n);
+      fileSize += n;
+    }
+    out.write((const char*)data, size);
+    fileSize += size;
+    return start;
+  };
+  for (const MeshData& mesh : meshes)
+  {
+    Block block;
+    block.offset = write(nullptr, 0, pageSize);
+    block.positions = write(mesh.positions.data(), mesh.positions.size_bytes(), SECTION_ALIGNMENT) - block.offset;
+    block.texCoords = write(mesh.texCoords.data(), mesh.texCoords.size_bytes(), SECTION_ALIGNMENT) - block.offset;
+    block.normals = write(mesh.normals.data(), mesh.normals.size_bytes(), SECTION_ALIGNMENT) - block.offset;
+    block.indices = write(mesh.indices.data(), mesh.indices.size_bytes(), SECTION_ALIGNMENT) - block.offset;
+    block.nodes = write(mesh.nodes.data(), mesh.nodes.size_bytes(), SECTION_ALIGNMENT) - block.offset;
+    block.size = fileSize - block.offset;
+    blocks.push_back(block);
+  }
+  out.close();
+  if (!out)
+  {
+    std::cout << "Could not write " << filename << std::endl;
+    return false;
+  }
+
+  // the new mapping starts out cold, so nothing is resident
+  file = std::make_unique<MappedFile>(filename);
+  if (!file->isOpen())
+    return false;
+  views.resize(blocks.size());
+  for (size_t i = 0; i < blocks.size(); ++i)
+  {
+    const char* base = file->getData() + blocks[i].offset;
+    views[i] = MeshView{
+        .positions = (const glm::vec3*)(base + blocks[i].positions),
+        .texCoords = (const uint32_t*)(base + blocks[i].texCoords),
+        .normals = (const uint32_t*)(base + blocks[i].normals),
+        .indices = base + blocks[i].indices,
+        .nodes = (const MeshNode*)(base + blocks[i].nodes),
+    };
+  }
+  lastUse = std::make_unique<std::atomic<uint64_t>[]>(blocks.size());
+  residentBytes.store(0, std::memory_order_relaxed);
+  return true;
+}
+
+void GeometryStream::prefetch(uint32_t model) const
+{
+  if (lastUse[model].load(std::memory_order_relaxed) != 0)
+    return;
+  lastUse[model].store(epoch, std::memory_order_relaxed);
+  file->prefetch(blocks[model].offset, blocks[model].size);
+}
+
+void GeometryStream::trim()
+{
+  TRACE_SCOPE("GeometryStream::trim");
+  std::vector<uint32_t> resident;
+  // counted here and published once, so a reader never sees a partial sum
+  uint64_t bytes = 0;
+  for (uint32_t i = 0; i < blocks.size(); ++i)
+  {
+    if (lastUse[i].load(std::memory_order_relaxed) == 0)
+      continue;
+    resident.push_back(i);
+    bytes += blocks[i].size;
+  }
+  if (bytes > budget)
+  {
+    std::sort(resident.begin(), resident.end(),
+              [&](uint32_t a, uint32_t b)
+              { return lastUse[a].load(std::memory_order_relaxed) < lastUse[b].load(std::memory_order_relaxed); });
+    for (uint32_t model : resident)
+    {
+      // the working set of the last pass stays, even if it alone is over the budget
+      if (bytes <= budget || lastUse[model].load(std::memory_order_relaxed) == epoch)
+        break;
+      file->evict(blocks[model].offset, blocks[model].size);
+      lastUse[model].store(0, std::memory_order_relaxed);
+      bytes -= blocks[model].size;
+    }
+  }
+  residentBytes.store(bytes, std::memory_order_relaxed);
+  epoch++;
+}
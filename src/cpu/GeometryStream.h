@@ -0,0 +1,82 @@
+#pragma once
+#include "MeshBVH.h"
+#include "util/MappedFile.h"
+#include <atomic>
+#include <glm/glm.hpp>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// pointers to the geometry of a single model, either into the scene pools or into a GeometryStream
+struct MeshView
+{
+  const glm::vec3* positions = nullptr;
+  const uint32_t* texCoords = nullptr;
+  const uint32_t* normals = nullptr;
+  // glm::u16vec3 or glm::uvec3 as told by ModelReference::hasShortIndices
+  const void* indices = nullptr;
+  const MeshNode* nodes = nullptr;
+};
+
+// geometry of a single model as it is written to a GeometryStream
+struct MeshData
+{
+  std::span<const glm::vec3> positions;
+  std::span<const uint32_t> texCoords;
+  std::span<const uint32_t> normals;
+  std::span<const std::byte> indices;
+  std::span<const MeshNode> nodes;
+};
+
+// bottom level geometry of the models in a memory mapped cache file, for scenes that do not fit into memory
+// the pages of a model are read in when a ray first enters it, trim evicts the least recently used models above the budget
+class GeometryStream
+{
+public:
+  GeometryStream(std::string_view filename, uint64_t budget);
+  // appends the models to the cache file and maps it again, no ray may be in flight
+  bool append(std::span<const MeshData> meshes);
+  uint32_t getNumModels() const { return (uint32_t)blocks.size(); }
+  MeshView view(uint32_t model) const
+  {
+    // the only bookkeeping on the hot path, a relaxed store once per model and pass
+    std::atomic<uint64_t>& used = lastUse[model];
+    if (used.load(std::memory_order_relaxed) != epoch)
+      used.store(epoch, std::memory_order_relaxed);
+    return views[model];
+  }
+  // reads the model ahead of the first ray that enters it
+  void prefetch(uint32_t model) const;
+  // called between passes, evicts models not used in the last pass until the resident ones fit the budget
+  void trim();
+  uint64_t getBudget() const { return budget; }
+  // bytes of the models touched since they were last evicted, the os may have dropped some of them already
+  uint64_t getResidentBytes() const { return residentBytes.load(std::memory_order_relaxed); }
+  uint64_t getFileBytes() const { return fileSize; }
+
+private:
+  struct Block
+  {
+    uint64_t offset;
+    uint64_t size;
+    // offsets of the sections relative to the block
+    uint64_t positions;
+    uint64_t texCoords;
+    uint64_t normals;
+    uint64_t indices;
+    uint64_t nodes;
+  };
+  std::string filename;
+  uint64_t budget;
+  uint64_t fileSize = 0;
+  std::unique_ptr<MappedFile> file;
+  std::vector<Block> blocks;
+  std::vector<MeshView> views;
+  // pass in which each model was last used, zero while it is not resident
+  std::unique_ptr<std::atomic<uint64_t>[]> lastUse;
+  uint64_t epoch = 1;
+  // written by trim, read from the ui
+  std::atomic<uint64_t> residentBytes = 0;
+};
@@ -0,0 +1,129 @@
+#include "MeshBVH.h"
+#include <algorithm>
+#include <numeric>
+
+struct BuildState
+{
+  std::span<const AABB> bounds;
+  std::vector<glm::vec3> centroids;
+  std::vector<uint32_t>& order;
+  std::vector<MeshNode>& nodes;
+};
+
+struct Bin
+{
+  AABB aabb;
+  uint32_t count = 0;
+};
+
+static uint32_t binIndex(float centroid, float min, float scale)
+{
+  return std::min((uint32_t)std::max((centroid - min) * scale, 0.0f), MeshBVH::NUM_BINS - 1);
+}
+
+static void buildNode(BuildState& state, uint32_t nodeIndex, uint32_t begin, uint32_t end, uint32_t depth)
+{
+  AABB aabb;
+  AABB centroidBounds;
+  for (uint32_t i = begin; i < end; ++i)
+  {
+    aabb = AABB::combine(aabb, state.bounds[state.order[i]]);
+    centroidBounds.adjust(state.centroids[state.order[i]]);
+  }
+  state.nodes[nodeIndex].aabb = aabb;
+  uint32_t count = end - begin;
+  if (count <= MeshBVH::MAX_LEAF_SIZE || depth >= MeshBVH::MAX_DEPTH)
+  {
+    state.nodes[nodeIndex].offset = begin;
+    state.nodes[nodeIndex].count = count;
+    return;
+  }
+
+  // cheapest split between the bins of any axis
+  glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+  float bestCost = std::numeric_limits<float>::max();
+  int bestAxis = -1;
+  uint32_t bestBin = 0;
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    if (extent[axis] <= 0)
+      continue;
+    float scale = MeshBVH::NUM_BINS / extent[axis];
+    Bin bins[MeshBVH::NUM_BINS];
+    for (uint32_t i = begin; i < end; ++i)
+    {
+      Bin& bin = bins[binIndex(state.centroids[state.order[i]][axis], centroidBounds.min[axis], scale)];
+      bin.aabb = AABB::combine(bin.aabb, state.bounds[state.order[i]]);
+      bin.count++;
+    }
+    // sweep from the right for the sizes of the right sides, then from the left for the costs
+    float rightArea[MeshBVH::NUM_BINS] = {};
+    uint32_t rightCount[MeshBVH::NUM_BINS] = {};
+    AABB right;
+    uint32_t numRight = 0;
+    for (uint32_t b = MeshBVH::NUM_BINS - 1; b > 0; --b)
+    {
+      right = AABB::combine(right, bins[b].aabb);
+      numRight += bins[b].count;
+      rightArea[b] = numRight > 0 ? right.surfaceArea() : 0;
+      rightCount[b] = numRight;
+    }
+    AABB left;
+    uint32_t numLeft = 0;
+    for (uint32_t b = 0; b + 1 < MeshBVH::NUM_BINS; ++b)
+    {
+      left = AABB::combine(left, bins[b].aabb);
+      numLeft += bins[b].count;
+      if (numLeft == 0 || rightCount[b + 1] == 0)
+        continue;
+      float cost = numLeft * left.surfaceArea() + rightCount[b + 1] * rightArea[b + 1];
+      if (cost < bestCost)
+      {
+        bestCost = cost;
+        bestAxis = axis;
+        bestBin = b;
+      }
+    }
+  }
+
+  uint32_t middle = begin + count / 2;
+  if (bestAxis >= 0)
+  {
+    float scale = MeshBVH::NUM_BINS / extent[bestAxis];
+    auto it = std::partition(state.order.begin() + begin, state.order.begin() + end, [&](uint32_t triangle)
+                             { return binIndex(state.centroids[triangle][bestAxis], centroidBounds.min[bestAxis], scale) <= bestBin; });
+    middle = (uint32_t)(it - state.order.begin());
+  }
+  // otherwise all centroids coincide and any split is as good as another
+
+  uint32_t leftIndex = (uint32_t)state.nodes.size();
+  state.nodes.emplace_back();
+  buildNode(state, leftIndex, begin, middle, depth + 1);
+  uint32_t rightIndex = (uint32_t)state.nodes.size();
+  state.nodes.emplace_back();
+  buildNode(state, rightIndex, middle, end, depth + 1);
+  state.nodes[nodeIndex].offset = rightIndex;
+}
+
+std::vector<MeshNode> MeshBVH::build(std::span<const AABB> triangleBounds, std::vector<uint32_t>& order)
+{
+  std::vector<MeshNode> nodes;
+  order.resize(triangleBounds.size());
+  std::iota(order.begin(), order.end(), 0);
+  if (triangleBounds.empty())
+    return nodes;
+  BuildState state = BuildState{
+      .bounds = triangleBounds,
+      .centroids = std::vector<glm::vec3>(triangleBounds.size()),
+      .order = order,
+      .nodes = nodes,
+  };
+  for (size_t i = 0; i < triangleBounds.size(); ++i)
+  {
+    state.centroids[i] = (triangleBounds[i].min + triangleBounds[i].max) * 0.5f;
+  }
+  nodes.reserve(triangleBounds.size() / MAX_LEAF_SIZE * 2 + 1);
+  nodes.emplace_back();
+  buildNode(state, 0, 0, (uint32_t)triangleBounds.size(), 0);
+  return nodes;
+}
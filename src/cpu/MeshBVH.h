@@ -0,0 +1,29 @@
+#pragma once
+#include "scene/AABB.h"
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// node of a bottom level hierarchy, stored depth first so the left child of an inner node directly follows it
+struct MeshNode
+{
+  AABB aabb;
+  // first triangle of a leaf, index of the right child of an inner node
+  uint32_t offset = 0;
+  // triangles in a leaf, zero for inner nodes
+  uint32_t count = 0;
+  bool isLeaf() const { return count > 0; }
+};
+
+// bounding volume hierarchy over the triangles of a single model
+class MeshBVH
+{
+public:
+  static constexpr uint32_t MAX_LEAF_SIZE = 4;
+  static constexpr uint32_t NUM_BINS = 16;
+  // also bounds the traversal stack, deeper nodes become leaves regardless of their size
+  static constexpr uint32_t MAX_DEPTH = 64;
+  // binned surface area heuristic over the triangle bounds
+  // order receives the triangle order in which every leaf is a contiguous range starting at its offset
+  static std::vector<MeshNode> build(std::span<const AABB> triangleBounds, std::vector<uint32_t>& order);
+};
@@ -0,0 +1,109 @@
+#include "PathGuide.h"
+#include "util/Color.h"
+#include "util/Trace.h"
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+// equal area, so every bin covers the same solid angle
+static uint32_t directionToBin(glm::vec3 direction)
+{
+  float u = (std::clamp(direction.z, -1.0f, 1.0f) + 1) * 0.5f;
+  float v = std::atan2(direction.y, direction.x) / (2 * std::numbers::pi_v<float>) + 0.5f;
+  uint32_t x = std::min((uint32_t)(u * PathGuide::RESOLUTION), PathGuide::RESOLUTION - 1);
+  uint32_t y = std::min((uint32_t)(v * PathGuide::RESOLUTION), PathGuide::RESOLUTION - 1);
+  return y * PathGuide::RESOLUTION + x;
+}
+
+static constexpr float BIN_SOLID_ANGLE = 4 * std::numbers::pi_v<float> / PathGuide::NUM_BINS;
+
+PathGuide::PathGuide(uint32_t numCells) : hash(numCells), cells(std::make_unique<Cell[]>(numCells)) {}
+
+void PathGuide::setCellSize(float size)
+{
+  if (size == cellSize)
+    return;
+  cellSize = size;
+  clear();
+}
+
+glm::vec3 PathGuide::sample(uint32_t cell, glm::vec2 rnd01, float& pdf) const noexcept
+{
+  const Cell& c = cells[cell];
+  uint32_t bin = std::min((uint32_t)(std::upper_bound(c.cdf, c.cdf + NUM_BINS, rnd01.x) - c.cdf), NUM_BINS - 1);
+  float begin = bin > 0 ? c.cdf[bin - 1] : 0;
+  float probability = c.cdf[bin] - begin;
+  // the part of the random number within the bin places the sample along cos theta
+  float fx = probability > 0 ? std::clamp((rnd01.x - begin) / probability, 0.0f, 1.0f) : 0.5f;
+  float z = ((bin % RESOLUTION) + fx) / RESOLUTION * 2 - 1;
+  float phi = (((bin / RESOLUTION) + rnd01.y) / RESOLUTION - 0.5f) * 2 * std::numbers::pi_v<float>;
+  float r = std::sqrt(std::max(1 - z * z, 0.0f));
+  pdf = probability / BIN_SOLID_ANGLE;
+  return glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+float PathGuide::pdf(uint32_t cell, glm::vec3 direction) const noexcept
+{
+  const Cell& c = cells[cell];
+  uint32_t bin = directionToBin(direction);
+  return (c.cdf[bin] - (bin > 0 ? c.cdf[bin - 1] : 0)) / BIN_SOLID_ANGLE;
+}
+
+void PathGuide::record(uint32_t cell, glm::vec3 direction, glm::vec3 radiance, float pdf) const noexcept
+{
+  Cell& c = cells[cell];
+  if (pdf > 0)
+    c.sum[directionToBin(direction)].fetch_add(luminance(radiance) / pdf, std::memory_order_relaxed);
+  c.count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PathGuide::resolve()
+{
+  TRACE_SCOPE("PathGuide::resolve");
+  for (uint32_t i = 0; i < hash.getNumSlots(); ++i)
+  {
+    Cell& c = cells[i];
+    uint32_t count = c.count.load(std::memory_order_relaxed);
+    if (count == 0)
+      continue;
+    c.samples += count;
+    c.count.store(0, std::memory_order_relaxed);
+    float total = 0;
+    for (uint32_t bin = 0; bin < NUM_BINS; ++bin)
+    {
+      c.energy[bin] += c.sum[bin].load(std::memory_order_relaxed);
+      c.sum[bin].store(0, std::memory_order_relaxed);
+      total += c.energy[bin];
+      c.cdf[bin] = total;
+    }
+    // a cell that saw no light at all keeps the cosine lobe
+    if (total <= 0)
+    {
+      c.samples = 0;
+      continue;
+    }
+    for (uint32_t bin = 0; bin < NUM_BINS; ++bin)
+    {
+      c.cdf[bin] /= total;
+    }
+    c.cdf[NUM_BINS - 1] = 1;
+  }
+}
+
+void PathGuide::clear()
+{
+  TRACE_SCOPE("PathGuide::clear");
+  hash.clear();
+  for (uint32_t i = 0; i < hash.getNumSlots(); ++i)
+  {
+    Cell& c = cells[i];
+    for (uint32_t bin = 0; bin < NUM_BINS; ++bin)
+    {
+      c.energy[bin] = 0;
+      c.cdf[bin] = 0;
+      c.sum[bin].store(0, std::memory_order_relaxed);
+    }
+    c.samples = 0;
+    c.count.store(0, std::memory_order_relaxed);
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "SpatialHash.h"
+#include <atomic>
+#include <glm/glm.hpp>
+#include <memory>
+
+// learned distribution of the light arriving at world space cells, for sampling the bounce directions of the paths
+// every cell holds a histogram over the sphere of directions, in an equal area mapping of cos theta and phi
+// paths splat the radiance they gathered after each bounce into the bin of its direction, weighted by its pdf
+// sampling reads the distributions of the finished passes, the samples of the current pass are only added up
+class PathGuide
+{
+public:
+  static constexpr uint32_t INVALID_CELL = SpatialHash::INVALID_SLOT;
+  // bins of the histograms along cos theta and along phi
+  static constexpr uint32_t RESOLUTION = 8;
+  static constexpr uint32_t NUM_BINS = RESOLUTION * RESOLUTION;
+  // a cell guides once this many paths have trained it, before that its histogram is mostly noise
+  static constexpr uint32_t MIN_SAMPLES = 64;
+  // numCells has to be a power of two
+  PathGuide(uint32_t numCells = 1 << 14);
+  PathGuide(const PathGuide&) = delete;
+  PathGuide& operator=(const PathGuide&) = delete;
+  // edge length of a cell in world units, changing it clears the guide, no ray may be in flight
+  void setCellSize(float size);
+  float getCellSize() const { return cellSize; }
+  // probability of sampling the guide instead of the cosine lobe at trained cells
+  void setGuideFraction(float fraction) { guideFraction = fraction; }
+  float getGuideFraction() const { return guideFraction; }
+  // the cell of a surface point, inserted if it is new, INVALID_CELL if the table is full around it
+  uint32_t findCell(glm::vec3 position, glm::vec3 normal) const noexcept { return hash.find(position, normal, cellSize); }
+  bool isTrained(uint32_t cell) const noexcept { return cells[cell].samples >= MIN_SAMPLES; }
+  // a direction drawn from the distribution of a trained cell and its solid angle pdf
+  glm::vec3 sample(uint32_t cell, glm::vec2 rnd01, float& pdf) const noexcept;
+  float pdf(uint32_t cell, glm::vec3 direction) const noexcept;
+  // adds the radiance that arrived from direction, sampled with pdf, to the current pass, lock free
+  void record(uint32_t cell, glm::vec3 direction, glm::vec3 radiance, float pdf) const noexcept;
+  // called between passes, adds the samples of the last pass to the distributions
+  void resolve();
+  // drops all cells, for when the scene or the lighting changes, no ray may be in flight
+  void clear();
+  uint32_t getNumUsedCells() const { return hash.getNumUsedSlots(); }
+
+private:
+  struct Cell
+  {
+    // accumulated over all passes, and its running sum normalized to one
+    float energy[NUM_BINS] = {};
+    float cdf[NUM_BINS] = {};
+    uint32_t samples = 0;
+    std::atomic<float> sum[NUM_BINS] = {};
+    std::atomic<uint32_t> count = 0;
+  };
+  SpatialHash hash;
+  // indexed like the slots of hash
+  std::unique_ptr<Cell[]> cells;
+  float cellSize = 0.5f;
+  float guideFraction = 0.5f;
+};
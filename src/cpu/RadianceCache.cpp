@@ -0,0 +1,60 @@
+#include "RadianceCache.h"
+#include "util/Trace.h"
+
+RadianceCache::RadianceCache(uint32_t numCells) : hash(numCells), cells(std::make_unique<Cell[]>(numCells)) {}
+
+void RadianceCache::setCellSize(float size)
+{
+  if (size == cellSize)
+    return;
+  cellSize = size;
+  clear();
+}
+
+void RadianceCache::update(uint32_t cell, glm::vec3 radiance) const noexcept
+{
+  Cell& c = cells[cell];
+  for (int i = 0; i < 3; ++i)
+  {
+    c.sum[i].fetch_add(radiance[i], std::memory_order_relaxed);
+  }
+  c.count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RadianceCache::resolve()
+{
+  TRACE_SCOPE("RadianceCache::resolve");
+  for (uint32_t i = 0; i < hash.getNumSlots(); ++i)
+  {
+    Cell& c = cells[i];
+    uint32_t count = c.count.load(std::memory_order_relaxed);
+    if (count == 0)
+      continue;
+    glm::vec3 sum = glm::vec3(c.sum[0].load(std::memory_order_relaxed), c.sum[1].load(std::memory_order_relaxed),
+                              c.sum[2].load(std::memory_order_relaxed));
+    c.radiance = (c.radiance * float(c.samples) + sum) / float(c.samples + count);
+    c.samples += count;
+    for (int j = 0; j < 3; ++j)
+    {
+      c.sum[j].store(0, std::memory_order_relaxed);
+    }
+    c.count.store(0, std::memory_order_relaxed);
+  }
+}
+
+void RadianceCache::clear()
+{
+  TRACE_SCOPE("RadianceCache::clear");
+  hash.clear();
+  for (uint32_t i = 0; i < hash.getNumSlots(); ++i)
+  {
+    Cell& c = cells[i];
+    c.radiance = glm::vec3(0);
+    c.samples = 0;
+    for (int j = 0; j < 3; ++j)
+    {
+      c.sum[j].store(0, std::memory_order_relaxed);
+    }
+    c.count.store(0, std::memory_order_relaxed);
+  }
+}
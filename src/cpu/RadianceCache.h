@@ -0,0 +1,61 @@
+#pragma once
+#include "SpatialHash.h"
+#include <atomic>
+#include <glm/glm.hpp>
+#include <memory>
+
+// world space hash grid of the radiance paths gather beyond a surface point, per unit of path throughput
+// paths that reach the cache depth end there with the estimate of their cell, a fraction of them continues to train it
+// lookups read the averages of the finished passes, the samples of the current pass are only added up
+class RadianceCache
+{
+public:
+  static constexpr uint32_t INVALID_CELL = SpatialHash::INVALID_SLOT;
+  // a cell answers lookups once it has this many samples, fewer would show up as blotches
+  static constexpr uint32_t MIN_SAMPLES = 4;
+  // numCells has to be a power of two
+  RadianceCache(uint32_t numCells = 1 << 18);
+  RadianceCache(const RadianceCache&) = delete;
+  RadianceCache& operator=(const RadianceCache&) = delete;
+  // edge length of a cell in world units, changing it clears the cache, no ray may be in flight
+  void setCellSize(float size);
+  float getCellSize() const { return cellSize; }
+  // fraction of the paths at the cache depth that continue and train it instead of ending there
+  void setUpdateRate(float rate) { updateRate = rate; }
+  float getUpdateRate() const { return updateRate; }
+  // depth of the hits that query the cache, 1 for the hit of the first bounce
+  void setDepth(uint32_t d) { depth = d; }
+  uint32_t getDepth() const { return depth; }
+  // the cell of a surface point, inserted if it is new, INVALID_CELL if the table is full around it
+  uint32_t findCell(glm::vec3 position, glm::vec3 normal) const noexcept { return hash.find(position, normal, cellSize); }
+  // false while the cell has fewer than MIN_SAMPLES
+  bool lookup(uint32_t cell, glm::vec3& radiance) const noexcept
+  {
+    const Cell& c = cells[cell];
+    radiance = c.radiance;
+    return c.samples >= MIN_SAMPLES;
+  }
+  // adds a sample to the current pass, lock free
+  void update(uint32_t cell, glm::vec3 radiance) const noexcept;
+  // called between passes, folds the samples of the last pass into the averages
+  void resolve();
+  // drops all cells, for when the scene or the lighting changes, no ray may be in flight
+  void clear();
+  uint32_t getNumUsedCells() const { return hash.getNumUsedSlots(); }
+
+private:
+  struct Cell
+  {
+    // running average over all passes so far
+    glm::vec3 radiance = glm::vec3(0);
+    uint32_t samples = 0;
+    std::atomic<float> sum[3] = {};
+    std::atomic<uint32_t> count = 0;
+  };
+  SpatialHash hash;
+  // indexed like the slots of hash
+  std::unique_ptr<Cell[]> cells;
+  float cellSize = 0.1f;
+  float updateRate = 0.1f;
+  uint32_t depth = 1;
+};
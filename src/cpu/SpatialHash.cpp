@@ -0,0 +1,55 @@
+#include "SpatialHash.h"
+
+// slots tried after the one a key hashes to before the table counts as full there
+static constexpr uint32_t MAX_PROBES = 8;
+
+static uint64_t mix(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return x;
+}
+
+SpatialHash::SpatialHash(uint32_t numSlots) : numSlots(numSlots), keys(std::make_unique<std::atomic<uint64_t>[]>(numSlots)) {}
+
+uint32_t SpatialHash::find(glm::vec3 position, glm::vec3 normal, float cellSize) const noexcept
+{
+  glm::ivec3 p = glm::ivec3(glm::floor(position / cellSize));
+  glm::vec3 a = glm::abs(normal);
+  uint32_t axis = a.x >= a.y && a.x >= a.z ? 0 : (a.y >= a.z ? 1 : 2);
+  uint32_t side = axis * 2 + (normal[axis] < 0 ? 1 : 0);
+  uint64_t hash = mix(mix((uint64_t(uint32_t(p.x)) << 32) | uint32_t(p.y)) ^ ((uint64_t(uint32_t(p.z)) << 3) | side));
+  // zero marks a free slot
+  uint64_t key = hash | 1;
+  for (uint32_t probe = 0; probe < MAX_PROBES; ++probe)
+  {
+    uint32_t slot = uint32_t(hash + probe) & (numSlots - 1);
+    uint64_t current = keys[slot].load(std::memory_order_relaxed);
+    if (current == key)
+      return slot;
+    if (current == 0)
+    {
+      // another ray may claim the slot first, for the same key or for another one
+      if (keys[slot].compare_exchange_strong(current, key, std::memory_order_relaxed))
+      {
+        usedSlots.fetch_add(1, std::memory_order_relaxed);
+        return slot;
+      }
+      if (current == key)
+        return slot;
+    }
+  }
+  return INVALID_SLOT;
+}
+
+void SpatialHash::clear()
+{
+  for (uint32_t i = 0; i < numSlots; ++i)
+  {
+    keys[i].store(0, std::memory_order_relaxed);
+  }
+  usedSlots.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <atomic>
+#include <glm/glm.hpp>
+#include <memory>
+
+// fixed size hash table of world space cells, the slots index the cells of RadianceCache and PathGuide
+// cells are keyed by position and the dominant axis of the normal, so the two sides of a thin wall stay apart
+// lookups insert lock free, nothing is removed before clear
+class SpatialHash
+{
+public:
+  static constexpr uint32_t INVALID_SLOT = ~0u;
+  // numSlots has to be a power of two
+  SpatialHash(uint32_t numSlots);
+  // the slot of the cell around a surface point, INVALID_SLOT if the table is full there
+  uint32_t find(glm::vec3 position, glm::vec3 normal, float cellSize) const noexcept;
+  // no lookup may run meanwhile
+  void clear();
+  uint32_t getNumSlots() const { return numSlots; }
+  uint32_t getNumUsedSlots() const { return usedSlots.load(std::memory_order_relaxed); }
+
+private:
+  uint32_t numSlots;
+  // zero for free slots, set once by the first ray that reaches a cell
+  std::unique_ptr<std::atomic<uint64_t>[]> keys;
+  mutable std::atomic<uint32_t> usedSlots = 0;
+};
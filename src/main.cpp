@@ -1,20 +1,27 @@
 #include "scene/Renderer.h"
 #include "cpu/CPURenderer.h"
 #include "util/ModelLoader.h"
+#include "util/Trace.h"
 #include <imgui.h>
+#include <algorithm>
 
 int main()
 {
+  Trace::setThreadName("main");
   std::unique_ptr<Renderer> renderer = std::make_unique<CPURenderer>();
   renderer->addDirectionalLight(DirectionalLight{
       .direction = glm::normalize(glm::vec3(-0.4f, -0.3f, -0.2f)),
       .color = glm::vec3(1, 1, 1),
   });
   renderer->addPointLight(PointLight{});
-  renderer->addModels(ModelLoader::loadModel("../../res/models/cube.fbx"),
-                      glm::mat4(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f), glm::vec4(0.0f, 1.0f, 0.0f, 0.0f), glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
-                                glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)));
-                                                                                                      renderer->generate();
+  // the window stays responsive while the models load, a preview of their bounds is shown until the scene is generated
+  renderer->generateAsync(
+      [&renderer](ThreadPool& pool)
+      {
+        renderer->addModels(ModelLoader::loadModel("../../res/models/cube.fbx", pool),
+                            glm::mat4(glm::vec4(1.0f, 0.0f, 0.0f, 0.0f), glm::vec4(0.0f, 1.0f, 0.0f, 0.0f),
+                                      glm::vec4(0.0f, 0.0f, 1.0f, 0.0f), glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+      });
   Camera camera = Camera{
       .position = glm::vec3(5, 1, 2),
       .target = glm::vec3(0, 0, 0),
@@ -32,6 +39,14 @@ int main()
   while (true)
   {
       renderer->beginFrame();
+      if (renderer->takeSceneUpdate())
+      {
+        renderer->startRender(camera, render);
+      }
+      if (renderer->isGenerating())
+      {
+        ImGui::Text("Generating scene: %.0f%%", renderer->getGenerateProgress() * 100.0f);
+      }
       ImGui::Text("Camera Parameters");
       ImGui::InputFloat3("Position", &camera.position.x);
       ImGui::InputFloat3("Target", &camera.target.x);
@@ -41,15 +56,89 @@ int main()
       ImGui::Text("Render Parameters");
       ImGui::InputInt2("Dimensions", (int*)&render.width);
       ImGui::InputInt("Samples", (int*)&render.numSamples);
+      ImGui::InputFloat("Time Budget (s)", &render.timeBudget);
+      ImGui::InputFloat("Target Error", &render.targetError);
+      ImGui::Checkbox("Reproject", &render.reproject);
+      ImGui::InputFloat("History Length", &render.historyLength);
+      ImGui::Checkbox("Shadows", &render.shadows);
+      ImGui::Checkbox("Bounces", &render.bounces);
+      ImGui::Checkbox("Radiance Cache", &render.radianceCache);
+      if (render.radianceCache)
+      {
+        ImGui::InputFloat("Cache Cell Size", &render.cacheCellSize);
+        ImGui::SliderFloat("Cache Update Rate", &render.cacheUpdateRate, 0.0f, 1.0f);
+        // negative input would wrap around, depths past the longest path are never reached
+        int cacheDepth = (int)render.cacheDepth;
+        if (ImGui::InputInt("Cache Depth", &cacheDepth))
+          render.cacheDepth = (uint32_t)std::clamp(cacheDepth, 0, (int)MAX_PATH_LENGTH);
+      }
+      ImGui::Checkbox("Path Guiding", &render.pathGuiding);
+      if (render.pathGuiding)
+      {
+        ImGui::InputFloat("Guide Cell Size", &render.guideCellSize);
+        ImGui::SliderFloat("Guide Fraction", &render.guideFraction, 0.0f, 1.0f);
+      }
+      const char* modes[] = {"Shaded", "Node Heatmap", "Triangle Heatmap"};
+      ImGui::Combo("Mode", (int*)&render.mode, modes, IM_ARRAYSIZE(modes));
       if (ImGui::Button("Render"))
       {
         renderer->startRender(camera, render);
       }
+      if (render.mode == RenderMode::Shaded && ImGui::Button("Save Image"))
+      {
+        renderer->writeImage("render.pfm");
+      }
+      if (render.mode != RenderMode::Shaded && ImGui::Button("Save Traversal Cost"))
+      {
+        renderer->writeTraversalCost("traversal_cost.pfm");
+      }
       ImGui::Text("Render Stats");
       ImGui::Text("Last Sample Time:    %.3f ms", renderer->getLastSampleTime());
       ImGui::Text("Average Sample Time: %.3f ms", renderer->getAverageSampleTime());
-      ImGui::PlotLines("Sample Times", renderer->getSampleTimes().data(), renderer->getSampleTimes().size(), 0, 0, FLT_MAX, FLT_MAX,
-                       ImVec2(0, 40));
+      ImGui::Text("P50/P99 Sample Time: %.3f / %.3f ms", renderer->getSampleTimes().percentile(0.5f),
+                  renderer->getSampleTimes().percentile(0.99f));
+      std::vector<float> sampleTimes = renderer->getSampleTimes().snapshot();
+      ImGui::PlotLines("Sample Times", sampleTimes.data(), (int)sampleTimes.size(), 0, 0, FLT_MAX, FLT_MAX, ImVec2(0, 40));
+      ImGui::Text("Predicted Passes:    %u", renderer->getPredictedPasses());
+      if (renderer->getEstimatedError() >= 0)
+      {
+        ImGui::Text("Estimated Error:     %.4f", renderer->getEstimatedError());
+      }
+      ImGui::Text("Last Throughput:     %.3f Mrays/s", renderer->getRaysPerSecond().back());
+      ImGui::Text("Average Throughput:  %.3f Mrays/s", renderer->getRaysPerSecond().mean());
+      std::vector<float> raysPerSecond = renderer->getRaysPerSecond().snapshot();
+      ImGui::PlotLines("Mrays/s", raysPerSecond.data(), (int)raysPerSecond.size(), 0, 0, FLT_MAX, FLT_MAX, ImVec2(0, 40));
+      RayStats stats = renderer->getRayStats();
+      for (uint32_t i = 0; i < (uint32_t)Counter::NumCounters; ++i)
+      {
+        ImGui::Text("%-20s %llu", Telemetry::counterName(Counter(i)).data(), (unsigned long long)stats[Counter(i)]);
+      }
+      float pathLengths[MAX_PATH_LENGTH + 1];
+      for (uint32_t i = 0; i <= MAX_PATH_LENGTH; ++i)
+      {
+        pathLengths[i] = (float)stats.pathLengths[i];
+      }
+      ImGui::PlotHistogram("Path Lengths", pathLengths, MAX_PATH_LENGTH + 1, 0, 0, 0, FLT_MAX, ImVec2(0, 40));
+      GeometryMemory memory = renderer->getGeometryMemory();
+      ImGui::Text("Geometry: %.1f MB, %.1f bytes/triangle (%.1f uncompressed)", memory.bytes / 1e6, memory.bytesPerTriangle(),
+                  memory.uncompressedBytesPerTriangle());
+      if (memory.residentBytes != memory.bytes)
+      {
+        ImGui::Text("Streamed: %.1f MB resident", memory.residentBytes / 1e6);
+      }
+      if (ImGui::Button("Dump Stats"))
+      {
+        renderer->writeStats("stats.json");
+      }
+      bool recordTrace = Trace::isEnabled();
+      if (ImGui::Checkbox("Record Trace", &recordTrace))
+      {
+        Trace::setEnabled(recordTrace);
+      }
+      if (ImGui::Button("Export Trace"))
+      {
+        Trace::writeChromeJson("trace.json");
+      }
       renderer->update();
     }
   return 0;
@@ -44,12 +44,16 @@ struct Payload
   float emissive = 1;
 };
 
+// models with at most this many vertices keep their indices in the 16 bit buffer
+constant uint MAX_SHORT_INDEX_VERTICES = 1 << 16;
+
 struct ModelReference
 {
   uint positionOffset = 0;
   uint numPositions = 0;
   uint indicesOffset = 0;
   uint numIndices = 0;
+  uint material = 0;
 };
 
 struct HitInfo
@@ -103,20 +107,25 @@ float3 rand01(uint3 x)
   return float3(x) * (1.0f / float(0xffffffffU));
 }
 
-template<typename T, typename IndexType>
-inline T interpolateVertexAttribute(constant T *attributes,
-                                    uint offset,
-                                    IndexType i0,
-                                    IndexType i1,
-                                    IndexType i2,
-                                    float2 uv) {
-    // Look up value for each vertex.
-    const T T0 = attributes[offset + i0];
-    const T T1 = attributes[offset + i1];
-    const T T2 = attributes[offset + i2];
+// the encodings of util/Packing.h
+float3 decodeNormal(uint encoded)
+{
+    float2 p = unpack_snorm2x16_to_float(encoded);
+    float3 n = float3(p.x, p.y, 1 - abs(p.x) - abs(p.y));
+    float t = max(-n.z, 0.0f);
+    n.x += n.x >= 0 ? -t : t;
+    n.y += n.y >= 0 ? -t : t;
+    return normalize(n);
+}
 
-    // Compute the sum of the vertex attributes weighted by the barycentric coordinates.
-    // The barycentric coordinates sum to one.
+float2 decodeTexCoord(uint encoded)
+{
+    return float2(as_type<half2>(encoded));
+}
+
+template<typename T>
+inline T interpolate(T T0, T T1, T T2, float2 uv)
+{
     return (1.0f - uv.x - uv.y) * T2 + uv.x * T0 + uv.y * T1;
 }
 
@@ -126,14 +135,15 @@ kernel void computeKernel(
     constant SampleParams& sample,
     constant packed_uint3* indexBuffer [[buffer(0)]],
     constant packed_float3* positions [[buffer(1)]],
-    constant packed_float2* texCoords [[buffer(2)]],
-    constant packed_float3* normals [[buffer(3)]],
+    constant uint* texCoords [[buffer(2)]],
+    constant uint* normals [[buffer(3)]],
     constant ModelReference* modelRefs [[buffer(4)]],
     constant BRDF* materials [[buffer(5)]],
     constant DirectionalLight* directionalLights [[buffer(6)]],
     constant PointLight* pointLights [[buffer(7)]],
     constant MTLAccelerationStructureInstanceDescriptor* instances [[buffer(8)]],
     instance_acceleration_structure accelerationStructure [[buffer(9)]],
+    constant packed_ushort3* shortIndexBuffer [[buffer(10)]],
     texture2d<float, access::read_write> accumulator [[texture(0)]],
     texture2d<float, access::read_write> image [[texture(1)]]
 )
@@ -199,10 +209,20 @@ kernel void computeKernel(
         
         HitInfo info;
         info.t = intersection.distance;
-        const auto indices = indexBuffer[ref.indicesOffset + intersection.primitive_id];
-        info.position = interpolateVertexAttribute(positions, ref.positionOffset, indices.x, indices.y, indices.z, intersection.triangle_barycentric_coord);
-        info.texCoords = interpolateVertexAttribute(texCoords, ref.positionOffset, indices.x, indices.y, indices.z, intersection.triangle_barycentric_coord);
-        info.normal = normalize(interpolateVertexAttribute(normals, ref.positionOffset, indices.x, indices.y, indices.z, intersection.triangle_barycentric_coord));
+        const uint3 indices = ref.numPositions <= MAX_SHORT_INDEX_VERTICES ? uint3(shortIndexBuffer[ref.indicesOffset + intersection.primitive_id])
+                                                                           : uint3(indexBuffer[ref.indicesOffset + intersection.primitive_id]);
+        // the buffers hold every model once in object space
+        float4x4 objectToWorld(1.0f);
+        for (int column = 0; column < 4; column++)
+            for (int row = 0; row < 3; row++)
+                objectToWorld[column][row] = instances[instanceId].transformationMatrix[column][row];
+        info.position = cam.origin + cam.direction * intersection.distance;
+        const uint3 vertices = ref.positionOffset + indices;
+        info.texCoords = interpolate(decodeTexCoord(texCoords[vertices.x]), decodeTexCoord(texCoords[vertices.y]), decodeTexCoord(texCoords[vertices.z]),
+                                     intersection.triangle_barycentric_coord);
+        float3 objectNormal = interpolate(decodeNormal(normals[vertices.x]), decodeNormal(normals[vertices.y]), decodeNormal(normals[vertices.z]),
+                                          intersection.triangle_barycentric_coord);
+        info.normal = normalize((objectToWorld * float4(objectNormal, 0)).xyz);
         info.normalLight = dot(info.normal, cam.direction) < 0 ? info.normal : -info.normal;
         
         BRDF brdf;
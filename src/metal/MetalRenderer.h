@@ -38,7 +38,8 @@ public:
     virtual void addPointLight(PointLight point) override;
     virtual void addDirectionalLight(DirectionalLight dir) override;
     virtual void addModel(PModel model, glm::mat4 transform) override;
-    virtual void addModels(std::vector<PModel> models, glm::mat4 transform) override;
+    virtual void addModels(ModelGroup group, glm::mat4 transform) override;
+    virtual GeometryMemory getGeometryMemory() const override;
     virtual void generate() override;
   virtual void render(Camera camera, RenderParameter params) override;
 
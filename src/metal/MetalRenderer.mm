@@ -87,7 +87,8 @@ MetalRenderer::~MetalRenderer() {
 void MetalRenderer::addPointLight(PointLight point) { scene->addPointLight(point); }
 void MetalRenderer::addDirectionalLight(DirectionalLight dir) { scene->addDirectionalLight(dir); }
 void MetalRenderer::addModel(PModel model, glm::mat4 transform) { scene->addModel(std::move(model), transform); }
-void MetalRenderer::addModels(std::vector<PModel> models, glm::mat4 transform) { scene->addModels(std::move(models), transform); }
+void MetalRenderer::addModels(ModelGroup group, glm::mat4 transform) { scene->addModels(std::move(group), transform); }
+GeometryMemory MetalRenderer::getGeometryMemory() const { return scene->getGeometryMemory(); }
 void MetalRenderer::generate() { scene->generate(); }
 
 void MetalRenderer::beginFrame()
@@ -181,6 +182,7 @@ void MetalRenderer::render(Camera camera, RenderParameter parameter)
       };
       [encoder setComputePipelineState:computePipeline];
       [encoder setBuffer:scene->indicesBuffer offset:0 atIndex:0];
+      [encoder setBuffer:scene->shortIndicesBuffer offset:0 atIndex:10];
       [encoder setBuffer:scene->positionBuffer offset:0 atIndex:1];
       [encoder setBuffer:scene->texCoordsBuffer offset:0 atIndex:2];
       [encoder setBuffer:scene->normalBuffer offset:0 atIndex:3];
@@ -218,12 +220,10 @@ void MetalRenderer::render(Camera camera, RenderParameter parameter)
       [encoder dispatchThreadgroups:threadgroups threadsPerThreadgroup:threadsPerThreadgroup];
       [encoder endEncoding];
       [cmdBuffer commit];
+      // the kernel does not count its rays, the camera rays of the pass are a lower bound
+      uint64_t cameraRays = (uint64_t)parameter.width * parameter.height;
       [cmdBuffer addCompletedHandler:^(id<MTLCommandBuffer> _Nonnull cmd) {
-        sampleTimes.push_back((cmd.GPUEndTime - cmd.GPUStartTime) * 1000.f);
-        if(sampleTimes.size() > 200)
-        {
-          sampleTimes.erase(sampleTimes.begin());
-        }
+        recordPass((cmd.GPUEndTime - cmd.GPUStartTime) * 1000.f, cameraRays);
       }];
     }
   }
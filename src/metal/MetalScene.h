@@ -9,7 +9,7 @@ public:
   MetalScene(id<MTLDevice> device, id<MTLCommandQueue> queue);
   virtual ~MetalScene();
 
-  virtual void createRayTracingHierarchy() override;
+  virtual void createRayTracingHierarchy(ThreadPool& pool) override;
   
   id<MTLAccelerationStructure> newAccelerationStructureWithDescriptor(MTLAccelerationStructureDescriptor* descriptor);
 
@@ -17,6 +17,7 @@ public:
   id<MTLCommandQueue> queue;
 
   id<MTLBuffer> indicesBuffer;
+  id<MTLBuffer> shortIndicesBuffer;
   id<MTLBuffer> positionBuffer;
   id<MTLBuffer> texCoordsBuffer;
   id<MTLBuffer> normalBuffer;
@@ -4,13 +4,23 @@ MetalScene::MetalScene(id<MTLDevice> device, id<MTLCommandQueue> queue) : device
 
 MetalScene::~MetalScene() {}
 
-void MetalScene::createRayTracingHierarchy()
+void MetalScene::createRayTracingHierarchy(ThreadPool& pool)
 {
-  indicesBuffer = [device newBufferWithLength:indicesPool.size() * sizeof(decltype(indicesPool)::value_type) options:MTLResourceStorageModeShared];
+  // either pool may be empty, metal does not create buffers of length zero
+  indicesBuffer = [device newBufferWithLength:std::max<size_t>(indicesPool.size() * sizeof(decltype(indicesPool)::value_type), 1)
+                                      options:MTLResourceStorageModeShared];
+  shortIndicesBuffer = [device newBufferWithLength:std::max<size_t>(shortIndicesPool.size() * sizeof(decltype(shortIndicesPool)::value_type), 1)
+                                           options:MTLResourceStorageModeShared];
   positionBuffer = [device newBufferWithLength:positionPool.size() * sizeof(decltype(positionPool)::value_type) options:MTLResourceStorageModeShared];
   texCoordsBuffer = [device newBufferWithLength:texCoordsPool.size() * sizeof(decltype(texCoordsPool)::value_type) options:MTLResourceStorageModeShared];
   normalBuffer = [device newBufferWithLength:normalsPool.size() * sizeof(decltype(normalsPool)::value_type) options:MTLResourceStorageModeShared];
-  modelRefsBuffer = [device newBufferWithLength:refs.size() * sizeof(decltype(refs)::value_type) options:MTLResourceStorageModeShared];
+  // the shader looks the model up by instance id
+  std::vector<ModelReference> instanceModels(instances.size());
+  for (uint i = 0; i < instances.size(); ++i)
+  {
+    instanceModels[i] = refs[instances[i].model];
+  }
+  modelRefsBuffer = [device newBufferWithLength:instanceModels.size() * sizeof(ModelReference) options:MTLResourceStorageModeShared];
   if (directionalLights.size() > 0)
   {
     directionalLightBuffer =
@@ -25,19 +35,29 @@ void MetalScene::createRayTracingHierarchy()
   }
 
   std::memcpy(indicesBuffer.contents, indicesPool.data(), indicesPool.size() * sizeof(decltype(indicesPool)::value_type));
+  std::memcpy(shortIndicesBuffer.contents, shortIndicesPool.data(), shortIndicesPool.size() * sizeof(decltype(shortIndicesPool)::value_type));
   std::memcpy(positionBuffer.contents, positionPool.data(), positionPool.size() * sizeof(decltype(positionPool)::value_type));
   std::memcpy(texCoordsBuffer.contents, texCoordsPool.data(), texCoordsPool.size() * sizeof(decltype(texCoordsPool)::value_type));
   std::memcpy(normalBuffer.contents, normalsPool.data(), normalsPool.size() * sizeof(decltype(normalsPool)::value_type));
-  std::memcpy(modelRefsBuffer.contents, refs.data(), refs.size() * sizeof(decltype(refs)::value_type));
+  std::memcpy(modelRefsBuffer.contents, instanceModels.data(), instanceModels.size() * sizeof(ModelReference));
     
   NSMutableArray* primitiveStructures = [[NSMutableArray alloc] init];
   for (uint i = 0; i < refs.size(); ++i)
   {
     MTLAccelerationStructureTriangleGeometryDescriptor* descriptor = [MTLAccelerationStructureTriangleGeometryDescriptor descriptor];
     descriptor.triangleCount = refs[i].numIndices;
-    descriptor.indexBuffer = indicesBuffer;
-    descriptor.indexBufferOffset = refs[i].indicesOffset * sizeof(glm::uvec3);
-    descriptor.indexType = MTLIndexTypeUInt32;
+    if (refs[i].hasShortIndices())
+    {
+      descriptor.indexBuffer = shortIndicesBuffer;
+      descriptor.indexBufferOffset = refs[i].indicesOffset * sizeof(glm::u16vec3);
+      descriptor.indexType = MTLIndexTypeUInt16;
+    }
+    else
+    {
+      descriptor.indexBuffer = indicesBuffer;
+      descriptor.indexBufferOffset = refs[i].indicesOffset * sizeof(glm::uvec3);
+      descriptor.indexType = MTLIndexTypeUInt32;
+    }
     descriptor.vertexBuffer = positionBuffer;
     descriptor.vertexBufferOffset = refs[i].positionOffset * sizeof(glm::vec3);
 
@@ -49,28 +69,22 @@ void MetalScene::createRayTracingHierarchy()
       [primitiveStructures addObject:accelerationStructure];
   }
   instanceBuffer =
-    [device newBufferWithLength:sizeof(MTLAccelerationStructureInstanceDescriptor) * refs.size() options:MTLResourceStorageModeShared];
+    [device newBufferWithLength:sizeof(MTLAccelerationStructureInstanceDescriptor) * instances.size() options:MTLResourceStorageModeShared];
 
   MTLAccelerationStructureInstanceDescriptor* instanceDescriptors =
       (MTLAccelerationStructureInstanceDescriptor*)instanceBuffer.contents;
-  for (uint i = 0; i < refs.size(); ++i)
+  for (uint i = 0; i < instances.size(); ++i)
   {
-    instanceDescriptors[i].transformationMatrix[0][0] = 1.0f;
-    instanceDescriptors[i].transformationMatrix[1][0] = 0.0f;
-    instanceDescriptors[i].transformationMatrix[2][0] = 0.0f;
-    instanceDescriptors[i].transformationMatrix[3][0] = 0.0f;
-
-    instanceDescriptors[i].transformationMatrix[0][1] = 0.0f;
-    instanceDescriptors[i].transformationMatrix[1][1] = 1.0f;
-    instanceDescriptors[i].transformationMatrix[2][1] = 0.0f;
-    instanceDescriptors[i].transformationMatrix[3][1] = 0.0f;
-
-    instanceDescriptors[i].transformationMatrix[0][2] = 0.0f;
-    instanceDescriptors[i].transformationMatrix[1][2] = 0.0f;
-    instanceDescriptors[i].transformationMatrix[2][2] = 1.0f;
-    instanceDescriptors[i].transformationMatrix[3][2] = 0.0f;
+    // packed 4x3, the bottom row of the affine transform is implicit
+    for (int column = 0; column < 4; ++column)
+    {
+      for (int row = 0; row < 3; ++row)
+      {
+        instanceDescriptors[i].transformationMatrix[column][row] = instances[i].objectToWorld[column][row];
+      }
+    }
 
-    instanceDescriptors[i].accelerationStructureIndex = i;
+    instanceDescriptors[i].accelerationStructureIndex = instances[i].model;
 
     instanceDescriptors[i].options = MTLAccelerationStructureInstanceOptionOpaque;
     instanceDescriptors[i].mask = 0xff;
@@ -78,7 +92,7 @@ void MetalScene::createRayTracingHierarchy()
   MTLInstanceAccelerationStructureDescriptor* accelDesc = [MTLInstanceAccelerationStructureDescriptor descriptor];
   [accelDesc setInstancedAccelerationStructures:primitiveStructures];
   [accelDesc setInstanceDescriptorBuffer:instanceBuffer];
-  [accelDesc setInstanceCount:refs.size()];
+  [accelDesc setInstanceCount:instances.size()];
     accelerationStructure = newAccelerationStructureWithDescriptor(accelDesc);
 }
 
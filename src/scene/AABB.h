@@ -56,7 +56,8 @@ struct AABB
         tmin = std::max(tmin, std::max(tsmaller.x, std::max(tsmaller.y, tsmaller.z)));
         tmax = std::min(tmax, std::min(tbigger.x, std::min(tbigger.y, tbigger.z)));
 
-        return (tmin < tmax);
+        // inclusive, the bounds of coplanar axis aligned triangles have no thickness along their normal
+        return (tmin <= tmax);
     }
     static AABB combine(AABB lhs, AABB rhs)
     {
@@ -1,13 +1,31 @@
 #include "Renderer.h"
+#include <cmath>
+#include <fstream>
 
 
 Renderer::Renderer()
 {
 }
 
-Renderer::~Renderer() {}
+Renderer::~Renderer()
+{
+  if (generator.joinable())
+    generator.join();
+}
 
-void Renderer::startRender(Camera cam, RenderParameter params)
+void Renderer::generateAsync(std::function<void(ThreadPool&)> load)
+{
+  stopRender();
+  if (load)
+  {
+    ThreadPool pool(ThreadPool::defaultNumWorkers());
+    load(pool);
+  }
+  generate();
+  sceneUpdated = true;
+}
+
+void Renderer::stopRender()
 {
   //threadPool.cancel();
   if (running)
@@ -15,7 +33,61 @@ void Renderer::startRender(Camera cam, RenderParameter params)
     running = false;
     worker.join();
   }
+}
+
+void Renderer::startRender(Camera cam, RenderParameter params)
+{
+  stopRender();
   sampleTimes.clear();
+  raysPerSecond.clear();
+  baseline = Telemetry::collect();
+  renderStart = std::chrono::steady_clock::now();
+  predictedPasses = params.numSamples;
+  estimatedError = -1;
   running = true;
   worker = std::thread(&Renderer::render, this, cam, params);
-}
\ No newline at end of file
+}
+
+void Renderer::recordPass(float milliseconds, uint64_t rays)
+{
+  sampleTimes.push(milliseconds);
+  raysPerSecond.push(rays / (milliseconds * 1000.0f));
+}
+
+bool Renderer::continueRender(const RenderParameter& params, uint32_t completedPasses, float error)
+{
+  uint32_t passes = params.numSamples > completedPasses ? params.numSamples - completedPasses : 0;
+  if (params.timeBudget > 0 && !sampleTimes.empty())
+  {
+    // a slow pass now and then must not break the deadline, so the prediction goes by the slow ones
+    float passMilliseconds = std::max(sampleTimes.percentile(0.9f), 1e-3f);
+    float elapsed = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - renderStart).count();
+    float left = std::max(params.timeBudget * 1000.0f - elapsed, 0.0f);
+    passes = std::min(passes, (uint32_t)std::min(left / passMilliseconds, 1e9f));
+  }
+  estimatedError.store(error, std::memory_order_relaxed);
+  if (params.targetError > 0 && error >= 0)
+  {
+    // the error falls with the square root of the samples
+    float needed = std::ceil(float(completedPasses) * (error / params.targetError) * (error / params.targetError));
+    passes = std::min(passes, (uint32_t)std::clamp(needed - float(completedPasses), 0.0f, 1e9f));
+  }
+  predictedPasses.store(passes, std::memory_order_relaxed);
+  return passes > 0;
+}
+
+void Renderer::writeStats(std::string_view filename) const
+{
+  std::ofstream out{std::string(filename)};
+  out << "{\n  \"counters\": ";
+  getRayStats().writeJson(out);
+  out << ",\n  \"sampleTimeMs\": ";
+  sampleTimes.writeJson(out);
+  out << ",\n  \"mraysPerSecond\": ";
+  raysPerSecond.writeJson(out);
+  GeometryMemory memory = getGeometryMemory();
+  out << ",\n  \"geometry\": {\"triangles\": " << memory.triangles << ", \"bytes\": " << memory.bytes
+      << ", \"residentBytes\": " << memory.residentBytes << ", \"bytesPerTriangle\": " << memory.bytesPerTriangle() << ", \"uncompressedBytesPerTriangle\": " << memory.uncompressedBytesPerTriangle()
+      << "}";
+  out << "\n}\n";
+}
@@ -1,14 +1,48 @@
 #pragma once
 #include "Scene.h"
 #include "util/Camera.h"
+#include "util/Telemetry.h"
+#include <chrono>
+#include <functional>
 #include <thread>
-#include <numeric>
+#include <string_view>
+
+enum class RenderMode
+{
+  Shaded,
+  // false colour of the BVH nodes visited by the primary ray
+  NodeHeatmap,
+  // false colour of the triangles tested by the primary ray
+  TriangleHeatmap,
+};
 
 struct RenderParameter
 {
   uint32_t width;
   uint32_t height;
+  // upper bound for the passes when there is a time budget or a target error
   uint32_t numSamples;
+  // stops after the last pass that is predicted to end within timeBudget seconds of the start, zero for no budget
+  float timeBudget = 0;
+  // stops once the estimated relative error of the image is below targetError, zero to render all passes
+  float targetError = 0;
+  // reproject the previous render into the new view instead of starting from noise
+  bool reproject = false;
+  // upper bound for the weight of the reprojected history, in samples
+  float historyLength = 32;
+  RenderMode mode = RenderMode::Shaded;
+  // shadow rays towards the lights, and paths beyond the first hit
+  bool shadows = true;
+  bool bounces = true;
+  // ends the paths at cacheDepth with the radiance cached near the hit, a fraction cacheUpdateRate of them trains the cache
+  bool radianceCache = false;
+  float cacheCellSize = 0.1f;
+  float cacheUpdateRate = 0.1f;
+  uint32_t cacheDepth = 1;
+  // samples the bounces from a guide learned from the earlier passes for a fraction guideFraction of them
+  bool pathGuiding = false;
+  float guideCellSize = 0.5f;
+  float guideFraction = 0.5f;
 };
 
 class Renderer
@@ -18,25 +52,62 @@ public:
   virtual ~Renderer();
   virtual void addPointLight(PointLight point) = 0;
   virtual void addDirectionalLight(DirectionalLight dir) = 0;
+  // ignored by backends that can not sample it
+  virtual void setEnvironmentMap(PEnvironmentMap map) {}
   virtual void addModel(PModel model, glm::mat4 transform) = 0;
-  virtual void addModels(std::vector<PModel> models, glm::mat4 transform) = 0;
+  virtual void addModels(ModelGroup group, glm::mat4 transform) = 0;
   virtual void generate() = 0;
+  // runs load, which adds the models, and generate, by default right away on the calling thread
+  // backends that can trace a preview meanwhile do both on a background thread
+  // load gets the pool generate uses, for loading the models in parallel
+  virtual void generateAsync(std::function<void(ThreadPool&)> load);
+  bool isGenerating() const { return generating.load(std::memory_order_acquire); }
+  virtual float getGenerateProgress() const { return isGenerating() ? 0.0f : 1.0f; }
+  // true once after the traced scene changed, the render has to be started again to show it
+  bool takeSceneUpdate() { return sceneUpdated.exchange(false); }
+  virtual GeometryMemory getGeometryMemory() const = 0;
   void startRender(Camera cam, RenderParameter params);
-  constexpr const std::vector<float>& getSampleTimes() const { return sampleTimes; }
-  constexpr const float getLastSampleTime() const { return sampleTimes.empty() ? 0 : sampleTimes.back(); }
-  constexpr const float getAverageSampleTime() const
-  {
-    return std::accumulate(sampleTimes.begin(), sampleTimes.end(), 0.0f) / sampleTimes.size();
-  }
+  static constexpr size_t NUM_STAT_SAMPLES = 256;
+  using StatSeries = RingBuffer<float, NUM_STAT_SAMPLES>;
+  constexpr const StatSeries& getSampleTimes() const { return sampleTimes; }
+  constexpr const StatSeries& getRaysPerSecond() const { return raysPerSecond; }
+  const float getLastSampleTime() const { return sampleTimes.back(); }
+  const float getAverageSampleTime() const { return sampleTimes.mean(); }
+  // passes still to come as predicted after the last one, from the pass times and the error so far
+  uint32_t getPredictedPasses() const { return predictedPasses.load(std::memory_order_relaxed); }
+  // relative error of the image after the last pass, negative until there is an estimate
+  float getEstimatedError() const { return estimatedError.load(std::memory_order_relaxed); }
+  // counters since the last startRender
+  RayStats getRayStats() const { return Telemetry::collect() - baseline; }
+  void writeStats(std::string_view filename) const;
+  // raw per pixel counts of the last heatmap render, as a pfm with nodes in red and triangles in green
+  virtual void writeTraversalCost(std::string_view filename) const {}
+  // linear radiance of the last finished pass as a pfm, normalized by the samples every pixel has, also while a render runs
+  virtual void writeImage(std::string_view filename) const {}
   // main thread
   virtual void beginFrame() = 0;
   virtual void update() = 0;
 
 protected:
   virtual void render(Camera cam, RenderParameter params) = 0;
+  // waits for the render thread to finish its pass
+  void stopRender();
   std::thread worker;
   std::atomic_bool running = false;
-  std::vector<float> sampleTimes;
+  std::thread generator;
+  std::atomic_bool generating = false;
+  std::atomic_bool sceneUpdated = false;
+  // records a finished sample pass, rays is the number of rays traced during it
+  void recordPass(float milliseconds, uint64_t rays);
+  // after completedPasses passes, false once the budget or the target error forbid another one, error is negative without an estimate
+  bool continueRender(const RenderParameter& params, uint32_t completedPasses, float error);
+  StatSeries sampleTimes;
+  // in Mrays/s
+  StatSeries raysPerSecond;
+  RayStats baseline;
+  std::chrono::steady_clock::time_point renderStart;
+  std::atomic<uint32_t> predictedPasses = 0;
+  std::atomic<float> estimatedError = 0;
   float lastSampleTime;
   float averageSampleTime;
 };
\ No newline at end of file
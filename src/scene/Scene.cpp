@@ -1,46 +1,315 @@
 #include "Scene.h"
+#include "util/Packing.h"
+#include "util/Trace.h"
+#include <algorithm>
+#include <span>
+
+// largest number of vertices or triangles handled by a single job
+static constexpr size_t CHUNK_SIZE = 1 << 16;
+
+struct Chunk
+{
+  uint32_t model;
+  size_t begin;
+  size_t end;
+};
+
+// splits the models into chunks of at most CHUNK_SIZE elements, count gives the number of elements of a model
+template <typename Count> static std::vector<Chunk> chunkModels(const std::vector<PModel>& models, Count count)
+{
+  std::vector<Chunk> chunks;
+  for (uint32_t m = 0; m < models.size(); ++m)
+  {
+    size_t numElements = count(*models[m]);
+    for (size_t begin = 0; begin < numElements; begin += CHUNK_SIZE)
+    {
+      chunks.push_back(Chunk{
+          .model = m,
+          .begin = begin,
+          .end = std::min(begin + CHUNK_SIZE, numElements),
+      });
+    }
+  }
+  return chunks;
+}
+
+// green, the color every hit had before the models brought their own materials
+Scene::Scene() { materials.push_back(Material{.albedo = glm::vec3(0, 1, 0)}); }
 
 void Scene::addModel(PModel model, glm::mat4 transform)
 {
-  model->transform(transform);
+  if (model->material == NO_MATERIAL)
+    model->material = 0;
+  addInstance((uint32_t)(refs.size() + models.size()), transform);
   models.push_back(std::move(model));
 }
 
-void Scene::addModels(std::vector<PModel> _models, glm::mat4 transform)
+void Scene::addModels(ModelGroup group, glm::mat4 transform)
 {
-  for (auto& _model : _models)
+  uint32_t first = (uint32_t)(refs.size() + models.size());
+  for (const auto& instance : group.instances)
+  {
+    addInstance(first + instance.model, transform * instance.transform);
+  }
+  // the materials of the group are appended, its models refer to them relative to the first one
+  uint32_t firstMaterial = (uint32_t)materials.size();
+  materials.insert(materials.end(), group.materials.begin(), group.materials.end());
+  for (auto& model : group.models)
   {
-    _model->transform(transform);
-    models.push_back(std::move(_model));
+    model->material = model->material < group.materials.size() ? firstMaterial + model->material : 0;
+    models.push_back(std::move(model));
+  }
+}
+
+uint32_t Scene::addMaterial(Material material)
+{
+  materials.push_back(std::move(material));
+  return (uint32_t)materials.size() - 1;
+}
+
+void Scene::addPrimitive(PrimitiveType type, glm::mat4 transform, uint32_t material)
+{
+  primitives.push_back(PrimitiveInstance{
+      .objectToWorld = transform,
+      .worldToObject = glm::inverse(transform),
+      .type = type,
+      .material = material < materials.size() ? material : 0,
+  });
+}
+
+void Scene::addInstance(uint32_t model, glm::mat4 transform)
+{
+  instances.push_back(InstanceReference{
+      .objectToWorld = transform,
+      .worldToObject = glm::inverse(transform),
+      .model = model,
+  });
+}
+
+// seed of the check hashes
+static constexpr uint64_t CHECK_SEED = 0x2545F4914F6CDD1Dull;
+
+void Scene::deduplicateModels(ThreadPool& pool)
+{
+  TRACE_SCOPE("Scene::deduplicateModels");
+  uint32_t first = (uint32_t)refs.size();
+  std::vector<uint64_t> hashes(models.size());
+  std::vector<uint64_t> checkHashes(models.size());
+  pool.parallelFor(hashes.size(), 1,
+                   [&](size_t begin, size_t end)
+                   {
+                     for (size_t i = begin; i < end; ++i)
+                     {
+                       hashes[i] = models[i]->hash();
+                       checkHashes[i] = models[i]->hash(CHECK_SEED);
+                     }
+                   });
+
+  // unique models are moved to the front, duplicates are dropped by the resize below
+  std::vector<uint32_t> remap(hashes.size());
+  uint32_t numUnique = 0;
+  for (uint32_t i = 0; i < hashes.size(); ++i)
+  {
+    const Model& model = *models[i];
+    auto matches = [&](const auto& entry)
+    {
+      // the same geometry with another material is another model
+      if (entry.second >= first)
+        return models[entry.second - first]->material == model.material && models[entry.second - first]->sameGeometry(model);
+      const ModelReference& reference = refs[entry.second];
+      return reference.material == model.material && reference.numPositions == model.positions.size() &&
+             reference.numIndices == model.indices.size() && modelCheckHashes[entry.second] == checkHashes[i];
+    };
+    auto [begin, end] = modelHashes.equal_range(hashes[i]);
+    auto match = std::find_if(begin, end, matches);
+    if (match != end)
+    {
+      remap[i] = match->second;
+      continue;
+    }
+    if (numUnique != i)
+    {
+      models[numUnique] = std::move(models[i]);
+    }
+    modelHashes.emplace(hashes[i], first + numUnique);
+    modelCheckHashes.push_back(checkHashes[i]);
+    remap[i] = first + numUnique++;
+  }
+  models.resize(numUnique);
+  for (auto& instance : instances)
+  {
+    if (instance.model >= first)
+      instance.model = remap[instance.model - first];
   }
 }
 
 void Scene::generate()
 {
-  // todo: clear everything
-  for (uint32_t i = 0; i < models.size(); ++i)
+  ThreadPool pool(ThreadPool::defaultNumWorkers());
+  generate(pool);
+}
+
+void Scene::generate(ThreadPool& pool)
+{
+  TRACE_SCOPE("Scene::generate");
+  generateProgress.store(0.0f, std::memory_order_relaxed);
+  auto countVertices = [](const Model& model) { return model.positions.size(); };
+  auto countTriangles = [](const Model& model) { return model.indices.size(); };
+  deduplicateModels(pool);
+  generateProgress.store(0.25f, std::memory_order_relaxed);
+
+  // the new models are appended, their offsets are the prefix sums of their sizes
+  uint32_t first = (uint32_t)refs.size();
+  uint32_t numPositions = (uint32_t)positionPool.size();
+  uint32_t numShortIndices = (uint32_t)shortIndicesPool.size();
+  uint32_t numIndices = (uint32_t)indicesPool.size();
+  for (const auto& model : models)
   {
-    auto& model = models[i];
-    ModelReference ref = {
-        .positionOffset = (uint32_t)positionPool.size(),
+    ModelReference reference = ModelReference{
+        .positionOffset = numPositions,
         .numPositions = (uint32_t)model->positions.size(),
-        .indicesOffset = (uint32_t)indicesPool.size(),
         .numIndices = (uint32_t)model->indices.size(),
+        .material = model->material,
     };
-    for (uint32_t i = 0; i < model->positions.size(); ++i)
-    {
-      positionPool.push_back(model->positions[i]);
-      texCoordsPool.push_back(model->texCoords[i]);
-      normalsPool.push_back(model->normals[i]);
-    }
-    for (uint32_t i = 0; i < model->indices.size(); ++i)
+    uint32_t& offset = reference.hasShortIndices() ? numShortIndices : numIndices;
+    reference.indicesOffset = offset;
+    offset += reference.numIndices;
+    numPositions += reference.numPositions;
+    numVertices += reference.numPositions;
+    numTriangles += reference.numIndices;
+    refs.push_back(reference);
+    modelBounds.push_back(model->boundingBox);
+  }
+  positionPool.resize(numPositions);
+  texCoordsPool.resize(numPositions);
+  normalsPool.resize(numPositions);
+  shortIndicesPool.resize(numShortIndices);
+  indicesPool.resize(numIndices);
+
+  auto vertexChunks = chunkModels(models, countVertices);
+  pool.parallelFor(vertexChunks.size(), 1,
+                   [&](size_t begin, size_t end)
+                   {
+                     for (const Chunk& c : std::span(vertexChunks).subspan(begin, end - begin))
+                     {
+                       const auto& model = models[c.model];
+                       uint32_t offset = refs[first + c.model].positionOffset;
+                       std::copy(model->positions.begin() + c.begin, model->positions.begin() + c.end, positionPool.begin() + offset + c.begin);
+                       for (size_t v = c.begin; v < c.end; ++v)
+                       {
+                         texCoordsPool[offset + v] = encodeTexCoord(model->texCoords[v]);
+                         normalsPool[offset + v] = encodeNormal(model->normals[v]);
+                       }
+                     }
+                   });
+  generateProgress.store(0.5f, std::memory_order_relaxed);
+  auto triangleChunks = chunkModels(models, countTriangles);
+  pool.parallelFor(triangleChunks.size(), 1,
+                   [&](size_t begin, size_t end)
+                   {
+                     for (const Chunk& c : std::span(triangleChunks).subspan(begin, end - begin))
+                     {
+                       const auto& model = models[c.model];
+                       const ModelReference& reference = refs[first + c.model];
+                       if (reference.hasShortIndices())
+                       {
+                         for (size_t i = c.begin; i < c.end; ++i)
+                         {
+                           shortIndicesPool[reference.indicesOffset + i] = glm::u16vec3(model->indices[i]);
+                         }
+                       }
+                       else
+                       {
+                         std::copy(model->indices.begin() + c.begin, model->indices.begin() + c.end,
+                                   indicesPool.begin() + reference.indicesOffset + c.begin);
+                       }
+                     }
+                   });
+  models.clear();
+  generateProgress.store(0.75f, std::memory_order_relaxed);
+  createMaterials();
+  numCreatedMaterials = (uint32_t)materials.size();
+  createRayTracingHierarchy(pool);
+  generateProgress.store(1.0f, std::memory_order_relaxed);
+}
+
+// box with a flat normal per face, empty for empty bounds
+static PModel createBox(const AABB& bounds)
+{
+  PModel box = std::make_unique<Model>();
+  box->boundingBox = bounds;
+  if (bounds.min.x > bounds.max.x)
+    return box;
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+    for (int side = 0; side < 2; ++side)
     {
-      indicesPool.push_back(model->indices[i]);
-      edgesPool.push_back(model->edges[i * 2 + 0]);
-      edgesPool.push_back(model->edges[i * 2 + 1]);
-      faceNormalsPool.push_back(glm::normalize(model->faceNormals[i]));
+      uint32_t first = (uint32_t)box->positions.size();
+      const glm::vec2 corners[] = {glm::vec2(0, 0), glm::vec2(1, 0), glm::vec2(1, 1), glm::vec2(0, 1)};
+      for (glm::vec2 corner : corners)
+      {
+        glm::vec3 position;
+        position[axis] = side ? bounds.max[axis] : bounds.min[axis];
+        position[u] = corner.x > 0 ? bounds.max[u] : bounds.min[u];
+        position[v] = corner.y > 0 ? bounds.max[v] : bounds.min[v];
+        glm::vec3 normal = glm::vec3(0);
+        normal[axis] = side ? 1.0f : -1.0f;
+        box->positions.push_back(position);
+        box->normals.push_back(normal);
+        box->texCoords.push_back(corner);
+      }
+      box->indices.push_back(glm::uvec3(first, first + 1, first + 2));
+      box->indices.push_back(glm::uvec3(first, first + 2, first + 3));
     }
-    refs.push_back(ref);
   }
-  createRayTracingHierarchy();
+  return box;
+}
+
+void Scene::createPreview(Scene& preview) const
+{
+  TRACE_SCOPE("Scene::createPreview");
+  // the boxes keep the numbering of refs followed by models, so the instances can be copied as they are
+  ModelGroup boxes;
+  for (const AABB& bounds : modelBounds)
+  {
+    boxes.models.push_back(createBox(bounds));
+  }
+  for (const auto& model : models)
+  {
+    boxes.models.push_back(createBox(model->boundingBox));
+  }
+  for (const InstanceReference& instance : instances)
+  {
+    boxes.instances.push_back(ModelInstance{
+        .model = instance.model,
+        .transform = instance.objectToWorld,
+    });
+  }
+  preview.addModels(std::move(boxes), glm::mat4(1.0f));
+  // cheap to trace as they are, only their materials stay behind
+  for (const PrimitiveInstance& primitive : primitives)
+  {
+    preview.addPrimitive(primitive.type, primitive.objectToWorld);
+  }
+  preview.pointLights = pointLights;
+  preview.directionalLights = directionalLights;
+}
+
+GeometryMemory Scene::getGeometryMemory() const
+{
+  uint64_t indexBytes = 0;
+  for (const ModelReference& reference : refs)
+  {
+    indexBytes += reference.numIndices * (reference.hasShortIndices() ? sizeof(glm::u16vec3) : sizeof(glm::uvec3));
+  }
+  uint64_t bytes = numVertices * (sizeof(glm::vec3) + sizeof(uint32_t) * 2) + indexBytes;
+  return GeometryMemory{
+      .triangles = numTriangles,
+      .bytes = bytes,
+      // position, texture coordinate and normal per vertex, indices, two edges and a face normal per triangle, all of it twice
+      .uncompressedBytes = 2 * (numVertices * sizeof(float) * 8 + numTriangles * (sizeof(glm::uvec3) + sizeof(glm::vec3) * 3)),
+      .residentBytes = bytes,
+  };
 }
@@ -1,14 +1,68 @@
 #pragma once
+#include "ThreadPool.h"
+#include "util/EnvironmentMap.h"
 #include "util/Model.h"
+#include <atomic>
 #include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+#include <unordered_map>
 #include <vector>
 
+// models with at most this many vertices keep their indices in the 16 bit pool
+static constexpr uint32_t MAX_SHORT_INDEX_VERTICES = 1 << 16;
+
 struct ModelReference
 {
   uint32_t positionOffset = 0;
   uint32_t numPositions = 0;
+  // into shortIndicesPool or indicesPool, depending on hasShortIndices
   uint32_t indicesOffset = 0;
   uint32_t numIndices = 0;
+  // into the material table of the scene
+  uint32_t material = 0;
+  bool hasShortIndices() const { return numPositions <= MAX_SHORT_INDEX_VERTICES; }
+};
+
+// placement of a model in the scene, the pools hold every unique model once in object space
+struct InstanceReference
+{
+  glm::mat4 objectToWorld;
+  glm::mat4 worldToObject;
+  uint32_t model;
+};
+
+// size of the scene geometry, triangles are counted once no matter how often they are instanced
+struct GeometryMemory
+{
+  uint64_t triangles = 0;
+  uint64_t bytes = 0;
+  // the same geometry with float attributes, 32 bit indices, edge and face normal pools
+  // and the copies the models kept after generate, the layout before the pools were compacted
+  uint64_t uncompressedBytes = 0;
+  // the part of bytes in memory, smaller when the geometry is streamed from disk
+  uint64_t residentBytes = 0;
+  float bytesPerTriangle() const { return triangles == 0 ? 0 : float(bytes) / triangles; }
+  float uncompressedBytesPerTriangle() const { return triangles == 0 ? 0 : float(uncompressedBytes) / triangles; }
+};
+
+// shapes intersected in closed form instead of as triangles, all of them in a unit object space
+enum class PrimitiveType
+{
+  // radius 1 around the origin
+  Sphere,
+  // the square from -1 to 1 in x and z at y = 0, scaled up for ground planes
+  Plane,
+  // from -1 to 1 on every axis
+  Box,
+};
+
+// placement of an analytic primitive in the scene
+struct PrimitiveInstance
+{
+  glm::mat4 objectToWorld;
+  glm::mat4 worldToObject;
+  PrimitiveType type;
+  uint32_t material = 0;
 };
 
 struct PointLight
@@ -30,32 +84,78 @@ struct DirectionalLight
 class Scene
 {
 public:
-  Scene(){}
+  Scene();
   virtual ~Scene(){}
   void addPointLight(PointLight point) { pointLights.push_back(point); }
   void addDirectionalLight(DirectionalLight dir) { directionalLights.push_back(dir); }
+  // lights the rays that leave the scene, replaces the previous one
+  void setEnvironmentMap(PEnvironmentMap map) { environment = std::move(map); }
   void addModel(PModel model, glm::mat4 transform);
-  void addModels(std::vector<PModel> models, glm::mat4 transform);
+  // the instances of the group are placed relative to transform
+  void addModels(ModelGroup group, glm::mat4 transform);
+  // returns the index of the material for addPrimitive
+  uint32_t addMaterial(Material material);
+  // the unit shape of type placed by transform, traced alongside the meshes
+  void addPrimitive(PrimitiveType type, glm::mat4 transform, uint32_t material = 0);
   void generate();
+  // merges identical models and appends the new ones to the pools on the pool's workers
+  // the models are released afterwards, the pools are the only copy of the geometry
+  void generate(ThreadPool& pool);
 
   constexpr uint32_t getNumDirLights() const { return (uint)directionalLights.size(); }
   constexpr uint32_t getNumPointLights() const { return (uint)pointLights.size(); }
+  // unique triangles, each stored once no matter how often it is instanced
+  constexpr uint32_t getNumTriangles() const { return numTriangles; }
+  constexpr uint32_t getNumModels() const { return (uint)refs.size(); }
+  constexpr uint32_t getNumInstances() const { return (uint)instances.size(); }
+  constexpr uint32_t getNumMaterials() const { return (uint)materials.size(); }
+  constexpr uint32_t getNumPrimitives() const { return (uint)primitives.size(); }
+  virtual GeometryMemory getGeometryMemory() const;
+  // fraction of the running generate that is done, may be read from any thread
+  float getGenerateProgress() const { return generateProgress.load(std::memory_order_relaxed); }
+  // adds a box around every model, placed like its instances, the primitives and the lights to preview
+  // cheap enough to show something while generate runs, the models have to stay untouched meanwhile
+  void createPreview(Scene& preview) const;
 
 protected:
   std::vector<ModelReference> refs;
+  // object space bounds of the models in refs
+  std::vector<AABB> modelBounds;
   std::vector<glm::vec3> positionPool;
-  std::vector<glm::vec2> texCoordsPool;
-  std::vector<glm::vec3> normalsPool;
+  // encoded with encodeTexCoord and encodeNormal from util/Packing.h
+  std::vector<uint32_t> texCoordsPool;
+  std::vector<uint32_t> normalsPool;
+  std::vector<glm::u16vec3> shortIndicesPool;
   std::vector<glm::uvec3> indicesPool;
-  std::vector<glm::vec3> edgesPool;
-  std::vector<glm::vec3> faceNormalsPool;
+  // totals over refs, the pools may have been released once a backend streams the geometry
+  uint64_t numVertices = 0;
+  uint32_t numTriangles = 0;
+  std::atomic<float> generateProgress = 1.0f;
 
   std::vector<PointLight> pointLights;
   std::vector<DirectionalLight> directionalLights;
+  PEnvironmentMap environment;
+  // the first one is used by models without a material
+  std::vector<Material> materials;
+  // materials before this one are known to the backend
+  uint32_t numCreatedMaterials = 0;
 
+  // models added since the last generate, they may still be duplicates
+  // instances refer to them by refs.size() + their index in here until generate
   std::vector<PModel> models;
+  std::vector<InstanceReference> instances;
+  std::vector<PrimitiveInstance> primitives;
+  // content hash to index in refs of every unique model, shared by all files added to the scene
+  std::unordered_multimap<uint64_t, uint32_t> modelHashes;
+  // second, independent hash of the models in refs
+  // backends may reorder the pools, so a new model can't be compared with them byte by byte
+  std::vector<uint64_t> modelCheckHashes;
 
-  virtual void createRayTracingHierarchy() = 0;
+  void addInstance(uint32_t model, glm::mat4 transform);
+  void deduplicateModels(ThreadPool& pool);
+  virtual void createRayTracingHierarchy(ThreadPool& pool) = 0;
+  // called by generate for the materials added since the last one, from numCreatedMaterials on
+  virtual void createMaterials() {}
 
   friend class GPURenderer;
 };
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include "Test.h"
+#include "ThreadPool.h"
+#include "util/ModelLoader.h"
+#include "util/ObjLoader.h"
+#include <cmath>
+#include <iostream>
+
+static bool compareTexCoords(const Model& native, const Model& assimp)
+{
+  if (native.positions.size() != assimp.positions.size())
+  {
+    std::cout << "vertex counts differ: " << native.positions.size() << " and " << assimp.positions.size() << std::endl;
+    return false;
+  }
+  bool equal = true;
+  // assimp may reorder the vertices, so they are matched by position
+  for (size_t i = 0; i < native.positions.size(); ++i)
+  {
+    size_t j = 0;
+    while (j < assimp.positions.size() && glm::distance(native.positions[i], assimp.positions[j]) > 1e-5f)
+    {
+      ++j;
+    }
+    if (j == assimp.positions.size())
+    {
+      std::cout << "vertex " << i << " is missing from the assimp model" << std::endl;
+      equal = false;
+      continue;
+    }
+    glm::vec2 a = native.texCoords[i];
+    glm::vec2 b = assimp.texCoords[j];
+    if (std::abs(a.x - b.x) > 1e-5f || std::abs(a.y - b.y) > 1e-5f)
+    {
+      std::cout << "vertex " << i << ": native (" << a.x << ", " << a.y << "), assimp (" << b.x << ", " << b.y << ")" << std::endl;
+      equal = false;
+    }
+  }
+  return equal;
+}
+
+// a textured quad through the native gltf loader and through assimp, both have to end up with the same texture coordinates
+bool loaderTexCoords(const std::string& dataDir)
+{
+  std::string filename = dataDir + "/quad.gltf";
+  ThreadPool pool(ThreadPool::defaultNumWorkers());
+  ModelGroup native = std::move(ModelLoader::loadModels({filename}, pool)[0]);
+  ModelGroup assimp = std::move(ModelLoader::loadModels({filename}, pool, false)[0]);
+  if (native.models.size() != 1 || assimp.models.size() != 1)
+  {
+    std::cout << filename << " should hold a single mesh, got " << native.models.size() << " and " << assimp.models.size() << std::endl;
+    return false;
+  }
+  return compareTexCoords(*native.models[0], *assimp.models[0]);
+}
+
+// relative vt and vn indices before the first element have to be rejected instead of read out of bounds
+bool objNegativeIndex(const std::string& dataDir)
+{
+  ThreadPool pool(ThreadPool::defaultNumWorkers());
+  for (const char* file : {"negative_texcoord.obj", "negative_normal.obj"})
+  {
+    ModelGroup result;
+    if (ObjLoader::load(dataDir + "/" + file, pool, result))
+    {
+      std::cout << file << " was accepted" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
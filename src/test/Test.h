@@ -0,0 +1,8 @@
+#pragma once
+#include <string>
+
+// every test reads its inputs from the res/test directory, prints what went wrong and returns whether it passed
+bool loaderTexCoords(const std::string& dataDir);
+bool objNegativeIndex(const std::string& dataDir);
+bool cubeFaceHit(const std::string& dataDir);
+bool texCoordInterpolation(const std::string& dataDir);
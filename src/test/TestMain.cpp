@@ -0,0 +1,34 @@
+#include "Test.h"
+#include <iostream>
+#include <string_view>
+
+// usage: RayTracerTests <test> <res/test directory>, exits with 1 if the test fails
+
+struct TestCase
+{
+  std::string_view name;
+  bool (*run)(const std::string& dataDir);
+};
+
+static const TestCase TESTS[] = {
+    {"LoaderTexCoords", loaderTexCoords},
+    {"ObjNegativeIndex", objNegativeIndex},
+    {"CubeFaceHit", cubeFaceHit},
+    {"TexCoordInterpolation", texCoordInterpolation},
+};
+
+int main(int argc, char** argv)
+{
+  if (argc < 3)
+  {
+    std::cout << "usage: RayTracerTests <test> <res/test directory>" << std::endl;
+    return 1;
+  }
+  for (const TestCase& test : TESTS)
+  {
+    if (test.name == argv[1])
+      return test.run(argv[2]) ? 0 : 1;
+  }
+  std::cout << "no test named " << argv[1] << std::endl;
+  return 1;
+}
@@ -0,0 +1,90 @@
+#include "Test.h"
+#include "ThreadPool.h"
+#include "cpu/CPUScene.h"
+#include <cmath>
+#include <iostream>
+
+// a cube from -1 to 1, every face its own four vertices and two triangles
+static PModel unitCube()
+{
+  PModel model = std::make_unique<Model>();
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    for (float side : {-1.0f, 1.0f})
+    {
+      glm::vec3 n = glm::vec3(0);
+      n[axis] = side;
+      glm::vec3 u = glm::vec3(0);
+      u[(axis + 1) % 3] = 1;
+      glm::vec3 v = glm::vec3(0);
+      v[(axis + 2) % 3] = 1;
+      uint32_t first = (uint32_t)model->positions.size();
+      for (glm::vec2 corner : {glm::vec2(-1, -1), glm::vec2(1, -1), glm::vec2(1, 1), glm::vec2(-1, 1)})
+      {
+        model->positions.push_back(n + corner.x * u + corner.y * v);
+        model->texCoords.push_back(corner * 0.5f + 0.5f);
+        model->normals.push_back(n);
+      }
+      model->indices.push_back(glm::uvec3(first, first + 1, first + 2));
+      model->indices.push_back(glm::uvec3(first, first + 2, first + 3));
+    }
+  }
+  model->computeBounds();
+  return model;
+}
+
+// rays straight at the middle of every face of a unit cube, the leaves of a face have flat bounds
+bool cubeFaceHit(const std::string& dataDir)
+{
+  ThreadPool pool(ThreadPool::defaultNumWorkers());
+  CPUScene scene;
+  scene.addModel(unitCube(), glm::mat4(1.0f));
+  scene.generate(pool);
+  bool passed = true;
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    for (float side : {-1.0f, 1.0f})
+    {
+      // off the diagonal the two triangles of a face share
+      glm::vec3 origin = glm::vec3(0.3f, 0.2f, 0.1f);
+      origin[axis] = side * 5;
+      glm::vec3 direction = glm::vec3(0);
+      direction[axis] = -side;
+      IntersectionInfo info = scene.generateIntersections(scene.hierarchy, Ray(origin, direction), 1e-4f, 1e20f);
+      if (std::abs(info.hitInfo.t - 4) > 1e-4f)
+      {
+        std::cout << "ray along axis " << axis << " from side " << side << " hit at " << info.hitInfo.t << " instead of 4" << std::endl;
+        passed = false;
+      }
+    }
+  }
+  return passed;
+}
+
+// hits inside a triangle, the texture coordinates of the cube faces follow the position on the face
+bool texCoordInterpolation(const std::string& dataDir)
+{
+  ThreadPool pool(ThreadPool::defaultNumWorkers());
+  CPUScene scene;
+  scene.addModel(unitCube(), glm::mat4(1.0f));
+  scene.generate(pool);
+  bool passed = true;
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    glm::vec3 origin = glm::vec3(0.3f, 0.2f, -0.4f);
+    origin[axis] = 5;
+    glm::vec3 direction = glm::vec3(0);
+    direction[axis] = -1;
+    IntersectionInfo info = scene.generateIntersections(scene.hierarchy, Ray(origin, direction), 1e-4f, 1e20f);
+    glm::vec2 expected = glm::vec2(origin[(axis + 1) % 3], origin[(axis + 2) % 3]) * 0.5f + 0.5f;
+    // the scene stores texture coordinates as halfs
+    glm::vec2 t = info.hitInfo.texCoords;
+    if (std::abs(t.x - expected.x) > 1e-3f || std::abs(t.y - expected.y) > 1e-3f)
+    {
+      std::cout << "face " << axis << ": (" << t.x << ", " << t.y << ") instead of (" << expected.x << ", " << expected.y << ")"
+                << std::endl;
+      passed = false;
+    }
+  }
+  return passed;
+}
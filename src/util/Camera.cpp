@@ -0,0 +1,68 @@
+#include "Camera.h"
+
+// distance between the sensor and the lens
+static constexpr float SENSOR_DISTANCE = 0.035f;
+
+static void basis(const Camera& camera, glm::vec3& dir, glm::vec3& cx, glm::vec3& cy)
+{
+  dir = glm::normalize(camera.target - camera.position);
+  cx = glm::normalize(glm::cross(dir, abs(dir.y) < 0.9 ? glm::vec3(0, 1, 0) : glm::vec3(0, 0, 1)));
+  cy = glm::cross(cx, dir);
+}
+
+Ray Camera::generateRay(glm::uvec2 pix, uint32_t samp, glm::uvec2 dims, glm::vec3 rnd01) const
+{
+  glm::vec3 dir, cx, cy;
+  basis(*this, dir, cx, cy);
+  Ray cam = Ray(position, dir);
+  const glm::vec2 sdim = sensorSize; // sensor size (36 x 24 mm)
+
+  float S_I = (S_O * f) / (S_O - f);
+
+  //-- sample sensor
+  glm::vec2 rnd2 = 2.0f * glm::vec2(rnd01); // vvv tent filter sample
+  glm::vec2 tent = glm::vec2(rnd2.x < 1 ? sqrt(rnd2.x) - 1 : 1 - sqrt(2 - rnd2.x), rnd2.y < 1 ? sqrt(rnd2.y) - 1 : 1 - sqrt(2 - rnd2.y));
+  glm::vec2 s = ((glm::vec2(pix) + 0.5f * (0.5f + glm::vec2((samp / 2) % 2, samp % 2) + tent)) / glm::vec2(dims) - 0.5f) * sdim;
+  glm::vec3 spos = cam.origin + cx * s.x + cy * s.y, lc = cam.origin + cam.direction * SENSOR_DISTANCE; // sample on 3d sensor plane
+  Ray r = Ray(lc, normalize(lc - spos));                                                                 // construct ray
+
+  //-- setup lens
+  glm::vec3 lensP = lc;
+  glm::vec3 lensN = -cam.direction;
+  glm::vec3 lensX = glm::cross(lensN, glm::vec3(0, 1, 0)); // the exact vector doesnt matter
+  glm::vec3 lensY = glm::cross(lensN, lensX);
+
+  glm::vec3 lensSample = lensP + rnd01.x * A * lensX + rnd01.y * A * lensY;
+
+  glm::vec3 focalPoint = cam.origin + (S_O + S_I) * cam.direction;
+  float t = glm::dot(focalPoint - r.origin, lensN) / glm::dot(r.direction, lensN);
+  glm::vec3 focus = r.origin + t * r.direction;
+  return Ray(lensSample, normalize(focus - lensSample)); // TODO: Fix lens
+}
+
+glm::vec3 Camera::unproject(glm::uvec2 pix, glm::uvec2 dims, float distance) const
+{
+  glm::vec3 dir, cx, cy;
+  basis(*this, dir, cx, cy);
+  // the jitter and the tent filter average out to the pixel center
+  glm::vec2 s = ((glm::vec2(pix) + 0.5f) / glm::vec2(dims) - 0.5f) * sensorSize;
+  glm::vec3 lc = position + dir * SENSOR_DISTANCE;
+  glm::vec3 spos = position + cx * s.x + cy * s.y;
+  return lc + glm::normalize(lc - spos) * distance;
+}
+
+bool Camera::project(glm::vec3 point, glm::uvec2 dims, glm::ivec2& pix) const
+{
+  glm::vec3 dir, cx, cy;
+  basis(*this, dir, cx, cy);
+  glm::vec3 d = point - (position + dir * SENSOR_DISTANCE);
+  float z = glm::dot(d, dir);
+  if (z <= 0)
+    return false;
+  glm::vec2 s = -SENSOR_DISTANCE * glm::vec2(glm::dot(d, cx), glm::dot(d, cy)) / z;
+  glm::vec2 p = (s / sensorSize + 0.5f) * glm::vec2(dims) - 0.5f;
+  pix = glm::ivec2(glm::floor(p + 0.5f));
+  return true;
+}
+
+float Camera::pixelSpread(glm::uvec2 dims) const { return sensorSize.x / dims.x / SENSOR_DISTANCE; }
@@ -1,4 +1,5 @@
 #pragma once
+#include "Ray.h"
 #include <glm/glm.hpp>
 
 struct Camera
@@ -9,4 +10,12 @@ struct Camera
     float S_O = 20;
     float f = 0.7;
     float A = 0.35;
-};
\ No newline at end of file
+    // lens ray through pixel pix for sample samp, rnd01 drives the tent filter and the lens sample
+    Ray generateRay(glm::uvec2 pix, uint32_t samp, glm::uvec2 dims, glm::vec3 rnd01) const;
+    // inverse of generateRay for the pixel center, ignoring the lens
+    glm::vec3 unproject(glm::uvec2 pix, glm::uvec2 dims, float distance) const;
+    // returns false if the point is behind the camera
+    bool project(glm::vec3 point, glm::uvec2 dims, glm::ivec2& pix) const;
+    // angle covered by a pixel, the spread of the ray cones of primary rays
+    float pixelSpread(glm::uvec2 dims) const;
+};
@@ -0,0 +1,5 @@
+#pragma once
+#include <glm/glm.hpp>
+
+// relative luminance of linear rec. 709 rgb
+inline float luminance(glm::vec3 c) { return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z; }
@@ -0,0 +1,86 @@
+#include "EnvironmentMap.h"
+#include "Color.h"
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+static constexpr float PI = std::numbers::pi_v<float>;
+
+// index of the interval of a cdf with a leading zero that contains value
+static uint32_t findInterval(const float* cdf, uint32_t size, float value)
+{
+  const float* upper = std::upper_bound(cdf + 1, cdf + size + 1, value);
+  return (uint32_t)std::min<ptrdiff_t>(upper - cdf - 1, size - 1);
+}
+
+EnvironmentMap::EnvironmentMap(uint32_t width, uint32_t height, std::span<const glm::vec3> source)
+    : width(width), height(height), texels(source.begin(), source.end())
+{
+  conditionalCdf.resize((size_t)(width + 1) * height);
+  marginalCdf.resize(height + 1);
+  for (uint32_t y = 0; y < height; ++y)
+  {
+    // rows near the poles cover less solid angle
+    float sinTheta = std::sin(PI * (y + 0.5f) / height);
+    float* cdf = &conditionalCdf[(size_t)y * (width + 1)];
+    cdf[0] = 0;
+    for (uint32_t x = 0; x < width; ++x)
+    {
+      cdf[x + 1] = cdf[x] + luminance(texels[(size_t)y * width + x]) * sinTheta;
+    }
+    marginalCdf[y + 1] = marginalCdf[y] + cdf[width];
+  }
+}
+
+glm::uvec2 EnvironmentMap::texel(glm::vec3 direction) const
+{
+  direction = glm::normalize(direction);
+  float u = std::atan2(direction.z, direction.x) / (2 * PI) + 0.5f;
+  float v = std::acos(std::clamp(direction.y, -1.0f, 1.0f)) / PI;
+  return glm::uvec2(std::min((uint32_t)(u * width), width - 1), std::min((uint32_t)(v * height), height - 1));
+}
+
+float EnvironmentMap::texelPdf(glm::uvec2 t) const
+{
+  float total = marginalCdf[height];
+  if (total <= 0)
+    return 1;
+  const float* cdf = &conditionalCdf[(size_t)t.y * (width + 1)];
+  return (cdf[t.x + 1] - cdf[t.x]) / total * float(width) * float(height);
+}
+
+glm::vec3 EnvironmentMap::evaluate(glm::vec3 direction) const
+{
+  glm::uvec2 t = texel(direction);
+  return texels[(size_t)t.y * width + t.x];
+}
+
+float EnvironmentMap::pdf(glm::vec3 direction) const
+{
+  glm::vec3 d = glm::normalize(direction);
+  float sinTheta = std::sqrt(std::max(1 - d.y * d.y, 0.0f));
+  if (sinTheta == 0)
+    return 0;
+  // the image spans 2 pi by pi, each texel maps to sin theta times its area in solid angle
+  return texelPdf(texel(d)) / (2 * PI * PI * sinTheta);
+}
+
+glm::vec3 EnvironmentMap::sample(glm::vec2 rnd01, glm::vec3& direction, float& pdf) const
+{
+  float total = marginalCdf[height];
+  uint32_t y = total > 0 ? findInterval(marginalCdf.data(), height, rnd01.y * total) : (uint32_t)(rnd01.y * (height - 1));
+  const float* cdf = &conditionalCdf[(size_t)y * (width + 1)];
+  uint32_t x = cdf[width] > 0 ? findInterval(cdf, width, rnd01.x * cdf[width]) : (uint32_t)(rnd01.x * (width - 1));
+
+  // the position within the texel is reused from the part of the random numbers the texel choice did not need
+  float rowWidth = marginalCdf[y + 1] - marginalCdf[y];
+  float texelWidth = cdf[x + 1] - cdf[x];
+  float fy = rowWidth > 0 ? std::clamp((rnd01.y * total - marginalCdf[y]) / rowWidth, 0.0f, 1.0f) : 0.5f;
+  float fx = texelWidth > 0 ? std::clamp((rnd01.x * cdf[width] - cdf[x]) / texelWidth, 0.0f, 1.0f) : 0.5f;
+  float phi = ((x + fx) / width - 0.5f) * 2 * PI;
+  float theta = (y + fy) / height * PI;
+  float sinTheta = std::sin(theta);
+  direction = glm::vec3(sinTheta * std::cos(phi), std::cos(theta), sinTheta * std::sin(phi));
+  pdf = sinTheta > 0 ? texelPdf(glm::uvec2(x, y)) / (2 * PI * PI * sinTheta) : 0;
+  return texels[(size_t)y * width + x];
+}
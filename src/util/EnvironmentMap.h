@@ -0,0 +1,35 @@
+#pragma once
+#include "Minimal.h"
+#include <glm/glm.hpp>
+#include <span>
+#include <vector>
+
+// hdr radiance of the sky in every direction, as an equirectangular image with +y up
+// directions are importance sampled from a marginal cdf over the rows and a conditional cdf per row
+// weighted by luminance and solid angle, so bright suns are found by a handful of samples
+class EnvironmentMap
+{
+public:
+  // linear rgb texels, row by row from the top
+  EnvironmentMap(uint32_t width, uint32_t height, std::span<const glm::vec3> texels);
+  glm::vec3 evaluate(glm::vec3 direction) const;
+  // solid angle density of sample for direction
+  float pdf(glm::vec3 direction) const;
+  // draws a direction with probability proportional to its radiance, returns the radiance
+  glm::vec3 sample(glm::vec2 rnd01, glm::vec3& direction, float& pdf) const;
+  uint32_t getWidth() const { return width; }
+  uint32_t getHeight() const { return height; }
+
+private:
+  uint32_t width;
+  uint32_t height;
+  std::vector<glm::vec3> texels;
+  // row major like texels, with a leading zero per row, (width + 1) * height entries
+  std::vector<float> conditionalCdf;
+  // height + 1 entries
+  std::vector<float> marginalCdf;
+  glm::uvec2 texel(glm::vec3 direction) const;
+  // density over the image in units of texels, relative to a uniform one
+  float texelPdf(glm::uvec2 texel) const;
+};
+DECLARE_REF(EnvironmentMap)
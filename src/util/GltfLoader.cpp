@@ -0,0 +1,389 @@
+#include "GltfLoader.h"
+#include "Json.h"
+#include "MappedFile.h"
+#include "Trace.h"
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+static constexpr uint32_t GLB_MAGIC = 0x46546C67;      // "glTF"
+static constexpr uint32_t GLB_CHUNK_JSON = 0x4E4F534A; // "JSON"
+static constexpr uint32_t GLB_CHUNK_BIN = 0x004E4942;  // "BIN\0"
+static constexpr uint32_t MODE_TRIANGLES = 4;
+
+enum class ComponentType : uint32_t
+{
+  Byte = 5120,
+  UnsignedByte = 5121,
+  Short = 5122,
+  UnsignedShort = 5123,
+  UnsignedInt = 5125,
+  Float = 5126,
+};
+
+struct GltfAccessor
+{
+  const char* data = nullptr;
+  size_t count = 0;
+  size_t stride = 0;
+  ComponentType componentType = ComponentType::Float;
+  uint32_t numComponents = 0;
+};
+
+static uint32_t readU32(const char* data)
+{
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint32_t componentSize(ComponentType type)
+{
+  switch (type)
+  {
+  case ComponentType::Byte:
+  case ComponentType::UnsignedByte:
+    return 1;
+  case ComponentType::Short:
+  case ComponentType::UnsignedShort:
+    return 2;
+  default:
+    return 4;
+  }
+}
+
+static uint32_t numComponents(std::string_view type)
+{
+  if (type == "SCALAR")
+    return 1;
+  if (type == "VEC2")
+    return 2;
+  if (type == "VEC3")
+    return 3;
+  if (type == "VEC4")
+    return 4;
+  return 0;
+}
+
+static bool getAccessor(const Json& document, const std::vector<std::string_view>& buffers, const Json& index, GltfAccessor& accessor)
+{
+  const Json& desc = document["accessors"][index.asIndex(SIZE_MAX)];
+  // accessors without a buffer view are all zero or sparse, neither shows up in our assets
+  if (desc.isNull() || !desc.has("bufferView") || desc.has("sparse"))
+    return false;
+  const Json& view = document["bufferViews"][desc["bufferView"].asIndex()];
+  size_t buffer = view["buffer"].asIndex(SIZE_MAX);
+  if (buffer >= buffers.size())
+    return false;
+  accessor.componentType = ComponentType(desc["componentType"].asIndex());
+  accessor.numComponents = numComponents(desc["type"].asString());
+  accessor.count = desc["count"].asIndex();
+  size_t elementSize = componentSize(accessor.componentType) * accessor.numComponents;
+  accessor.stride = view["byteStride"].asIndex(elementSize);
+  size_t viewOffset = view["byteOffset"].asIndex(0);
+  size_t viewEnd = std::min(viewOffset + view["byteLength"].asIndex(0), buffers[buffer].size());
+  size_t offset = viewOffset + desc["byteOffset"].asIndex(0);
+  if (accessor.numComponents == 0 || accessor.count == 0 || offset + (accessor.count - 1) * accessor.stride + elementSize > viewEnd)
+    return false;
+  accessor.data = buffers[buffer].data() + offset;
+  return true;
+}
+
+// float attribute into dst, a single memcpy when the data is tightly packed
+template <typename T> static bool readFloats(const GltfAccessor& accessor, std::vector<T>& dst)
+{
+  if (accessor.componentType != ComponentType::Float || accessor.numComponents * sizeof(float) != sizeof(T))
+    return false;
+  dst.resize(accessor.count);
+  if (accessor.stride == sizeof(T))
+  {
+    std::memcpy(dst.data(), accessor.data, accessor.count * sizeof(T));
+    return true;
+  }
+  for (size_t i = 0; i < accessor.count; ++i)
+  {
+    std::memcpy(&dst[i], accessor.data + i * accessor.stride, sizeof(T));
+  }
+  return true;
+}
+
+static bool readIndices(const GltfAccessor& accessor, size_t numVertices, std::vector<glm::uvec3>& indices)
+{
+  if (accessor.numComponents != 1 || accessor.count % 3 != 0)
+    return false;
+  uint32_t size = componentSize(accessor.componentType);
+  if (accessor.componentType != ComponentType::UnsignedByte && accessor.componentType != ComponentType::UnsignedShort &&
+      accessor.componentType != ComponentType::UnsignedInt)
+    return false;
+  indices.resize(accessor.count / 3);
+  for (size_t i = 0; i < accessor.count; ++i)
+  {
+    uint32_t index = 0;
+    // little endian, so the low bytes of index are the value
+    std::memcpy(&index, accessor.data + i * accessor.stride, size);
+    if (index >= numVertices)
+      return false;
+    indices[i / 3][i % 3] = index;
+  }
+  return true;
+}
+
+static bool loadPrimitive(const Json& document, const std::vector<std::string_view>& buffers, const Json& primitive, Model& model)
+{
+  if (primitive["mode"].asIndex(MODE_TRIANGLES) != MODE_TRIANGLES)
+    return false;
+  const Json& attributes = primitive["attributes"];
+  GltfAccessor accessor;
+  if (!getAccessor(document, buffers, attributes["POSITION"], accessor) || !readFloats(accessor, model.positions))
+    return false;
+  size_t numVertices = model.positions.size();
+  if (attributes.has("TEXCOORD_0"))
+  {
+    if (!getAccessor(document, buffers, attributes["TEXCOORD_0"], accessor) || !readFloats(accessor, model.texCoords) ||
+        model.texCoords.size() != numVertices)
+      return false;
+  }
+  else
+  {
+    model.texCoords.resize(numVertices);
+  }
+  if (primitive.has("indices"))
+  {
+    if (!getAccessor(document, buffers, primitive["indices"], accessor) || !readIndices(accessor, numVertices, model.indices))
+      return false;
+  }
+  else
+  {
+    if (numVertices % 3 != 0)
+      return false;
+    model.indices.resize(numVertices / 3);
+    for (uint32_t i = 0; i < model.indices.size(); ++i)
+    {
+      model.indices[i] = glm::uvec3(i * 3, i * 3 + 1, i * 3 + 2);
+    }
+  }
+  if (attributes.has("NORMAL"))
+  {
+    if (!getAccessor(document, buffers, attributes["NORMAL"], accessor) || !readFloats(accessor, model.normals) ||
+        model.normals.size() != numVertices)
+      return false;
+    model.repairNormals();
+  }
+  else
+  {
+    model.generateNormals();
+  }
+  model.computeBounds();
+  model.material = (uint32_t)primitive["material"].asIndex(NO_MATERIAL);
+  return true;
+}
+
+static float number(const Json& value, float fallback) { return (float)value.asNumber(fallback); }
+
+// local transform of a node, either a full matrix or translation, rotation and scale
+static glm::mat4 nodeTransform(const Json& node)
+{
+  glm::mat4 transform(1.0f);
+  if (node.has("matrix"))
+  {
+    // column major like glm
+    const Json& matrix = node["matrix"];
+    for (int i = 0; i < 16; ++i)
+    {
+      transform[i / 4][i % 4] = number(matrix[i], i / 4 == i % 4 ? 1.0f : 0.0f);
+    }
+    return transform;
+  }
+  const Json& t = node["translation"];
+  const Json& r = node["rotation"];
+  const Json& s = node["scale"];
+  float x = number(r[0], 0), y = number(r[1], 0), z = number(r[2], 0), w = number(r[3], 1);
+  glm::mat3 rotation = glm::mat3(glm::vec3(1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w)),
+                                 glm::vec3(2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w)),
+                                 glm::vec3(2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y)));
+  for (int c = 0; c < 3; ++c)
+  {
+    transform[c] = glm::vec4(rotation[c] * number(s[c], 1), 0);
+  }
+  transform[3] = glm::vec4(number(t[0], 0), number(t[1], 0), number(t[2], 0), 1);
+  return transform;
+}
+
+// file of an image next to the gltf file, empty for images in buffers or data uris
+static std::string texturePath(const Json& document, const Json& textureInfo, std::string_view filename)
+{
+  const Json& texture = document["textures"][textureInfo["index"].asIndex(SIZE_MAX)];
+  const Json& image = document["images"][texture["source"].asIndex(SIZE_MAX)];
+  std::string_view uri = image["uri"].asString();
+  if (uri.empty() || uri.starts_with("data:"))
+    return {};
+  return (std::filesystem::path(filename).parent_path() / std::filesystem::path(uri)).string();
+}
+
+// the metallic roughness model is reduced to its base color, the renderer only knows blinn phong
+static Material loadMaterial(const Json& document, const Json& material, std::string_view filename)
+{
+  Material result;
+  const Json& pbr = material["pbrMetallicRoughness"];
+  const Json& baseColor = pbr["baseColorFactor"];
+  result.albedo = glm::vec3(number(baseColor[0], 1), number(baseColor[1], 1), number(baseColor[2], 1));
+  const Json& emissive = material["emissiveFactor"];
+  result.emissive = glm::vec3(number(emissive[0], 0), number(emissive[1], 0), number(emissive[2], 0));
+  if (pbr.has("baseColorTexture"))
+    result.albedoTexture = texturePath(document, pbr["baseColorTexture"], filename);
+  if (material.has("emissiveTexture"))
+    result.emissiveTexture = texturePath(document, material["emissiveTexture"], filename);
+  return result;
+}
+
+struct MeshRange
+{
+  uint32_t first;
+  uint32_t count;
+};
+
+static void addNode(const Json& document, const std::vector<MeshRange>& meshes, size_t index, glm::mat4 parent, uint32_t depth, ModelGroup& result)
+{
+  const Json& nodes = document["nodes"];
+  // the node graph has to be a forest, this only guards against broken files
+  if (index >= nodes.size() || depth > nodes.size())
+    return;
+  const Json& node = nodes[index];
+  glm::mat4 transform = parent * nodeTransform(node);
+  size_t mesh = node["mesh"].asIndex(SIZE_MAX);
+  if (mesh < meshes.size())
+  {
+    for (uint32_t m = 0; m < meshes[mesh].count; ++m)
+    {
+      result.instances.push_back(ModelInstance{
+          .model = (uint32_t)result.models.size() + meshes[mesh].first + m,
+          .transform = transform,
+      });
+    }
+  }
+  const Json& children = node["children"];
+  for (size_t c = 0; c < children.size(); ++c)
+  {
+    addNode(document, meshes, children[c].asIndex(SIZE_MAX), transform, depth + 1, result);
+  }
+}
+
+bool GltfLoader::load(std::string_view filename, ThreadPool& pool, ModelGroup& result)
+{
+  TRACE_SCOPE("GltfLoader::load");
+  MappedFile file(filename);
+  if (!file.isOpen())
+    return false;
+  std::string_view text = file.view();
+  std::string_view binChunk;
+  if (text.size() >= 12 && readU32(text.data()) == GLB_MAGIC)
+  {
+    std::string_view jsonChunk;
+    for (size_t offset = 12; offset + 8 <= text.size();)
+    {
+      uint32_t length = readU32(text.data() + offset);
+      uint32_t type = readU32(text.data() + offset + 4);
+      std::string_view chunk = text.substr(offset + 8, length);
+      if (type == GLB_CHUNK_JSON)
+        jsonChunk = chunk;
+      else if (type == GLB_CHUNK_BIN)
+        binChunk = chunk;
+      // chunks are padded to 4 bytes
+      offset += 8 + ((length + 3) & ~3u);
+    }
+    text = jsonChunk;
+  }
+  Json document = Json::parse(text);
+  if (document.isNull())
+    return false;
+
+  // external buffers are mapped next to the main file, data uris are left to assimp
+  std::vector<std::unique_ptr<MappedFile>> externalFiles;
+  std::vector<std::string_view> buffers;
+  const Json& bufferDescs = document["buffers"];
+  for (size_t i = 0; i < bufferDescs.size(); ++i)
+  {
+    const Json& desc = bufferDescs[i];
+    if (!desc.has("uri"))
+    {
+      if (i != 0 || binChunk.empty())
+        return false;
+      buffers.push_back(binChunk);
+      continue;
+    }
+    std::string_view uri = desc["uri"].asString();
+    if (uri.starts_with("data:"))
+      return false;
+    std::filesystem::path path = std::filesystem::path(filename).parent_path() / std::filesystem::path(uri);
+    externalFiles.push_back(std::make_unique<MappedFile>(path.string()));
+    if (!externalFiles.back()->isOpen())
+      return false;
+    buffers.push_back(externalFiles.back()->view());
+  }
+
+  // every primitive becomes a model, in the order assimp would produce them
+  std::vector<const Json*> primitives;
+  const Json& meshes = document["meshes"];
+  std::vector<MeshRange> meshRanges(meshes.size());
+  for (size_t m = 0; m < meshes.size(); ++m)
+  {
+    const Json& meshPrimitives = meshes[m]["primitives"];
+    meshRanges[m] = MeshRange{
+        .first = (uint32_t)primitives.size(),
+        .count = (uint32_t)meshPrimitives.size(),
+    };
+    for (size_t p = 0; p < meshPrimitives.size(); ++p)
+    {
+      primitives.push_back(&meshPrimitives[p]);
+    }
+  }
+  std::vector<PModel> models(primitives.size());
+  std::atomic_bool valid = true;
+  pool.parallelFor(primitives.size(), 1,
+                   [&](size_t begin, size_t end)
+                   {
+                     for (size_t i = begin; i < end; ++i)
+                     {
+                       models[i] = std::make_unique<Model>();
+                       if (!loadPrimitive(document, buffers, *primitives[i], *models[i]))
+                         valid = false;
+                     }
+                   });
+  if (!valid)
+  {
+    std::cout << filename << ": unsupported gltf content" << std::endl;
+    return false;
+  }
+
+  // meshes are placed by the nodes of the default scene, a file without scenes shows every mesh once
+  const Json& scene = document["scenes"][document["scene"].asIndex(0)];
+  if (scene.isNull())
+  {
+    for (uint32_t m = 0; m < models.size(); ++m)
+    {
+      result.instances.push_back(ModelInstance{
+          .model = (uint32_t)result.models.size() + m,
+          .transform = glm::mat4(1.0f),
+      });
+    }
+  }
+  const Json& roots = scene["nodes"];
+  for (size_t r = 0; r < roots.size(); ++r)
+  {
+    addNode(document, meshRanges, roots[r].asIndex(SIZE_MAX), glm::mat4(1.0f), 0, result);
+  }
+  uint32_t firstMaterial = (uint32_t)result.materials.size();
+  const Json& materials = document["materials"];
+  for (size_t m = 0; m < materials.size(); ++m)
+  {
+    result.materials.push_back(loadMaterial(document, materials[m], filename));
+  }
+  for (auto& model : models)
+  {
+    if (model->material != NO_MATERIAL)
+      model->material += firstMaterial;
+    result.models.push_back(std::move(model));
+  }
+  return true;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include "Model.h"
+#include "ThreadPool.h"
+#include <string_view>
+
+// reader for gltf 2.0 and its binary glb container
+// attributes are copied once, straight from the mapped file into the models
+// every mesh is loaded once and placed by the nodes of the default scene
+class GltfLoader
+{
+public:
+  // false if the file could not be read or uses something this loader does not understand
+  static bool load(std::string_view filename, ThreadPool& pool, ModelGroup& result);
+};
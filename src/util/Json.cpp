@@ -0,0 +1,172 @@
+#include "Json.h"
+#include <charconv>
+#include <iostream>
+
+static const Json NULL_VALUE;
+
+struct Json::Parser
+{
+  std::string_view text;
+  size_t pos = 0;
+  bool failed = false;
+
+  void skipWhitespace()
+  {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+      pos++;
+  }
+  bool consume(char c)
+  {
+    skipWhitespace();
+    if (pos < text.size() && text[pos] == c)
+    {
+      pos++;
+      return true;
+    }
+    return false;
+  }
+  void fail()
+  {
+    if (!failed)
+      std::cout << "Invalid json at offset " << pos << std::endl;
+    failed = true;
+  }
+  std::string parseString()
+  {
+    std::string result;
+    if (!consume('"'))
+    {
+      fail();
+      return result;
+    }
+    while (pos < text.size() && text[pos] != '"')
+    {
+      char c = text[pos++];
+      if (c == '\\' && pos < text.size())
+      {
+        char e = text[pos++];
+        switch (e)
+        {
+        case 'n':
+          result += '\n';
+          break;
+        case 't':
+          result += '\t';
+          break;
+        case 'r':
+          result += '\r';
+          break;
+        case 'b':
+          result += '\b';
+          break;
+        case 'f':
+          result += '\f';
+          break;
+        case 'u':
+        {
+          // names in gltf files are the only place this shows up, keep ascii and replace the rest
+          unsigned int code = 0;
+          std::from_chars(text.data() + pos, text.data() + std::min(pos + 4, text.size()), code, 16);
+          pos += 4;
+          result += code < 0x80 ? (char)code : '?';
+          break;
+        }
+        default:
+          result += e;
+        }
+      }
+      else
+      {
+        result += c;
+      }
+    }
+    if (pos >= text.size())
+      fail();
+    pos++;
+    return result;
+  }
+  Json parseValue()
+  {
+    Json value;
+    skipWhitespace();
+    if (pos >= text.size())
+    {
+      fail();
+      return value;
+    }
+    char c = text[pos];
+    if (c == '{')
+    {
+      pos++;
+      value.type = Type::Object;
+      if (consume('}'))
+        return value;
+      do
+      {
+        skipWhitespace();
+        std::string key = parseString();
+        if (!consume(':'))
+          fail();
+        value.members.emplace_back(std::move(key), parseValue());
+      } while (!failed && consume(','));
+      if (!consume('}'))
+        fail();
+    }
+    else if (c == '[')
+    {
+      pos++;
+      value.type = Type::Array;
+      if (consume(']'))
+        return value;
+      do
+      {
+        value.elements.push_back(parseValue());
+      } while (!failed && consume(','));
+      if (!consume(']'))
+        fail();
+    }
+    else if (c == '"')
+    {
+      value.type = Type::String;
+      value.string = parseString();
+    }
+    else if (text.substr(pos, 4) == "true" || text.substr(pos, 5) == "false")
+    {
+      value.type = Type::Bool;
+      value.boolean = c == 't';
+      pos += value.boolean ? 4 : 5;
+    }
+    else if (text.substr(pos, 4) == "null")
+    {
+      pos += 4;
+    }
+    else
+    {
+      value.type = Type::Number;
+      auto [end, error] = std::from_chars(text.data() + pos, text.data() + text.size(), value.number);
+      if (error != std::errc())
+        fail();
+      pos = end - text.data();
+    }
+    return value;
+  }
+};
+
+Json Json::parse(std::string_view text)
+{
+  Parser parser = {.text = text};
+  Json result = parser.parseValue();
+  return parser.failed ? Json() : result;
+}
+
+const Json& Json::operator[](std::string_view key) const
+{
+  for (const auto& [name, value] : members)
+  {
+    if (name == key)
+      return value;
+  }
+  return NULL_VALUE;
+}
+
+const Json& Json::operator[](size_t index) const { return index < elements.size() ? elements[index] : NULL_VALUE; }
@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// minimal json document, enough for reading gltf headers
+// lookups of missing keys or indices return a null value instead of failing
+class Json
+{
+public:
+  enum class Type
+  {
+    Null,
+    Bool,
+    Number,
+    String,
+    Array,
+    Object,
+  };
+  // returns a null value and prints the position on malformed input
+  static Json parse(std::string_view text);
+
+  Type getType() const { return type; }
+  bool isNull() const { return type == Type::Null; }
+  bool has(std::string_view key) const { return !(*this)[key].isNull(); }
+  const Json& operator[](std::string_view key) const;
+  const Json& operator[](size_t index) const;
+  size_t size() const { return type == Type::Array ? elements.size() : type == Type::Object ? members.size() : 0; }
+  double asNumber(double fallback = 0) const { return type == Type::Number ? number : fallback; }
+  size_t asIndex(size_t fallback = 0) const { return type == Type::Number ? (size_t)number : fallback; }
+  bool asBool(bool fallback = false) const { return type == Type::Bool ? boolean : fallback; }
+  std::string_view asString() const { return string; }
+
+private:
+  struct Parser;
+  Type type = Type::Null;
+  bool boolean = false;
+  double number = 0;
+  std::string string;
+  std::vector<Json> elements;
+  std::vector<std::pair<std::string, Json>> members;
+};
@@ -0,0 +1,119 @@
+#include "MappedFile.h"
+#include <algorithm>
+#include <iostream>
+#include <string>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(std::string_view filename)
+{
+  file = CreateFileA(std::string(filename).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    file = nullptr;
+    std::cout << "Could not open " << filename << std::endl;
+    return;
+  }
+  LARGE_INTEGER fileSize;
+  GetFileSizeEx(file, &fileSize);
+  size = (size_t)fileSize.QuadPart;
+  opened = true;
+  if (size == 0)
+    return;
+  mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping != nullptr)
+  {
+    data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  }
+}
+
+MappedFile::~MappedFile()
+{
+  if (data != nullptr)
+    UnmapViewOfFile(data);
+  if (mapping != nullptr)
+    CloseHandle(mapping);
+  if (file != nullptr)
+    CloseHandle(file);
+}
+
+void MappedFile::prefetch(size_t offset, size_t length) const
+{
+  if (data == nullptr || offset >= size)
+    return;
+  WIN32_MEMORY_RANGE_ENTRY range = {(void*)(data + offset), std::min(length, size - offset)};
+  PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+void MappedFile::evict(size_t offset, size_t length) const
+{
+  if (data == nullptr || offset >= size)
+    return;
+  // removes the pages from the working set, clean file pages are read back on the next touch
+  VirtualUnlock((void*)(data + offset), std::min(length, size - offset));
+}
+
+size_t MappedFile::pageSize()
+{
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwPageSize;
+}
+#else
+MappedFile::MappedFile(std::string_view filename)
+{
+  int fd = open(std::string(filename).c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    std::cout << "Could not open " << filename << std::endl;
+    return;
+  }
+  struct stat info;
+  if (fstat(fd, &info) == 0)
+  {
+    size = (size_t)info.st_size;
+    opened = true;
+    if (size > 0)
+    {
+      void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped != MAP_FAILED)
+      {
+        data = (const char*)mapped;
+      }
+    }
+  }
+  // the mapping keeps the file alive
+  close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+  if (data != nullptr)
+    munmap((void*)data, size);
+}
+
+void MappedFile::prefetch(size_t offset, size_t length) const
+{
+  if (data == nullptr || offset >= size)
+    return;
+  madvise((void*)(data + offset), std::min(length, size - offset), MADV_WILLNEED);
+}
+
+void MappedFile::evict(size_t offset, size_t length) const
+{
+  if (data == nullptr || offset >= size)
+    return;
+  // the mapping is read only, so dropped pages are read back from the file on the next touch
+  madvise((void*)(data + offset), std::min(length, size - offset), MADV_DONTNEED);
+}
+
+size_t MappedFile::pageSize() { return (size_t)sysconf(_SC_PAGESIZE); }
+#endif
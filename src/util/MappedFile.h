@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+
+// read only view of a whole file through the virtual memory system
+class MappedFile
+{
+public:
+  MappedFile(std::string_view filename);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  bool isOpen() const { return opened && (size == 0 || data != nullptr); }
+  const char* getData() const { return data; }
+  size_t getSize() const { return size; }
+  std::string_view view() const { return std::string_view(data, size); }
+  // hints for the pages of a range, prefetch reads them ahead and evict drops them until they are touched again
+  void prefetch(size_t offset, size_t length) const;
+  void evict(size_t offset, size_t length) const;
+  static size_t pageSize();
+
+private:
+  const char* data = nullptr;
+  size_t size = 0;
+  bool opened = false;
+#ifdef _WIN32
+  void* file = nullptr;
+  void* mapping = nullptr;
+#endif
+};
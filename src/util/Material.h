@@ -1,13 +1,19 @@
 #pragma once
 #include "Minimal.h"
-#include "Texture.h"
-#include "Ray.h"
 #include "BRDF.h"
+#include <glm/glm.hpp>
+#include <string>
 
+// surface description as loaded with the models, the backends turn it into their own material table
 class Material
 {
 public:
-  BRDF evaluate(HitInfo hitInfo);
-  PTexture albedoTexture;
-  PTexture emissiveTexture;
-};
\ No newline at end of file
+  glm::vec3 albedo = glm::vec3(1, 1, 1);
+  glm::vec3 specularColor = glm::vec3(1, 1, 1);
+  float shininess = 0.04f;
+  glm::vec3 emissive = glm::vec3(0, 0, 0);
+  MaterialType materialType = MaterialType::BlinnPhong;
+  // image files multiplied with the colors, empty if there is none
+  std::string albedoTexture;
+  std::string emissiveTexture;
+};
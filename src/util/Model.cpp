@@ -1,4 +1,6 @@
 #include "Model.h"
+#include <algorithm>
+#include <cstring>
 
 void Model::transform(glm::mat4 matrix)
 {
@@ -6,21 +8,108 @@ void Model::transform(glm::mat4 matrix)
   {
     pos = glm::vec3(matrix * glm::vec4(pos, 1));
   }
-
   for (auto& nor : normals)
   {
     nor = glm::mat3(matrix) * nor;
   }
-
   boundingBox.transform(matrix);
+}
+
+void Model::computeBounds()
+{
+  boundingBox = AABB();
+  for (const auto& pos : positions)
+  {
+    boundingBox.adjust(pos);
+  }
+}
+
+void Model::generateNormals()
+{
+  normals.assign(positions.size(), glm::vec3(0));
+  for (const auto& index : indices)
+  {
+    // the cross product is twice the triangle area, so larger faces weigh more
+    glm::vec3 n = glm::cross(positions[index.y] - positions[index.x], positions[index.z] - positions[index.x]);
+    normals[index.x] += n;
+    normals[index.y] += n;
+    normals[index.z] += n;
+  }
+  for (auto& nor : normals)
+  {
+    float length = glm::length(nor);
+    nor = length > 0 ? nor / length : glm::vec3(0);
+  }
+  repairNormals();
+}
 
-  for (int i = 0; i < indices.size(); i++)
+void Model::repairNormals()
+{
+  auto broken = [](glm::vec3 n) { return !(glm::dot(n, n) > 1e-12f); };
+  if (std::none_of(normals.begin(), normals.end(), broken))
+    return;
+  for (const auto& index : indices)
+  {
+    glm::vec3 n = glm::cross(positions[index.y] - positions[index.x], positions[index.z] - positions[index.x]);
+    float length = glm::length(n);
+    if (!(length > 0))
+      continue;
+    for (int i = 0; i < 3; ++i)
+    {
+      if (broken(normals[index[i]]))
+        normals[index[i]] = n / length;
+    }
+  }
+  // vertices of degenerate faces only
+  for (auto& nor : normals)
   {
-    auto e0 = positions[indices[i].y] - positions[indices[i].x];
-    auto e1 = positions[indices[i].z] - positions[indices[i].x];
-    edges.push_back(e0);
-    edges.push_back(e1);
+    if (broken(nor))
+      nor = glm::vec3(0, 1, 0);
+  }
+}
 
-    faceNormals.push_back(glm::cross(e0, e1));
+// word at a time mix, not cryptographic but fast enough to run over every mesh of a scene
+static uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+{
+  const char* bytes = (const char*)data;
+  uint64_t h = seed ^ (size * 0x9E3779B97F4A7C15ull);
+  auto mix = [&](uint64_t word)
+  {
+    h ^= word * 0xBF58476D1CE4E5B9ull;
+    h = (h << 31 | h >> 33) * 0x94D049BB133111EBull;
+  };
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8)
+  {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, 8);
+    mix(word);
+  }
+  if (i < size)
+  {
+    uint64_t word = 0;
+    std::memcpy(&word, bytes + i, size - i);
+    mix(word);
   }
+  return h ^ (h >> 29);
+}
+
+template <typename T> static bool sameContents(const std::vector<T>& lhs, const std::vector<T>& rhs)
+{
+  return lhs.size() == rhs.size() && std::memcmp(lhs.data(), rhs.data(), lhs.size() * sizeof(T)) == 0;
+}
+
+uint64_t Model::hash(uint64_t seed) const
+{
+  uint64_t h = hashBytes(positions.data(), positions.size() * sizeof(glm::vec3), seed);
+  h = hashBytes(texCoords.data(), texCoords.size() * sizeof(glm::vec2), h);
+  h = hashBytes(normals.data(), normals.size() * sizeof(glm::vec3), h);
+  return hashBytes(indices.data(), indices.size() * sizeof(glm::uvec3), h);
+}
+
+bool Model::sameGeometry(const Model& other) const
+{
+  // bitwise, so models that only differ in the sign of a zero are kept apart
+  return sameContents(positions, other.positions) && sameContents(texCoords, other.texCoords) && sameContents(normals, other.normals) &&
+         sameContents(indices, other.indices);
 }
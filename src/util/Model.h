@@ -1,6 +1,7 @@
 #pragma once
 #include "Minimal.h"
 #include "Material.h"
+#include "Ray.h"
 #include "scene/AABB.h"
 #include <optional>
 #include <vector>
@@ -9,7 +10,11 @@ struct IntersectionInfo
 {
   HitInfo hitInfo;
   BRDF brdf;
+  // into the material table of the scene, brdf is filled from it by the shading
+  uint32_t material = 0;
 };
+// material of a model that has none, the scene falls back to its default material
+static constexpr uint32_t NO_MATERIAL = ~0u;
 class Model
 {
 public:
@@ -18,8 +23,32 @@ public:
   std::vector<glm::vec2> texCoords;
   std::vector<glm::vec3> normals;
   std::vector<glm::uvec3> indices;
-  std::vector<glm::vec3> edges;
-  std::vector<glm::vec3> faceNormals;
+  // into the materials of its group, or of the scene once added
+  uint32_t material = NO_MATERIAL;
   void transform(glm::mat4 matrix);
+  void computeBounds();
+  // area weighted vertex normals, for files that come without any
+  void generateNormals();
+  // replaces zero normals, as left by shared normals that cancel out, by the normal of a face the vertex belongs to
+  void repairNormals();
+  // content hash over all vertex attributes and indices, equal geometry hashes equal
+  // different seeds give independent hashes
+  uint64_t hash(uint64_t seed = 0) const;
+  bool sameGeometry(const Model& other) const;
 };
-DECLARE_REF(Model)
\ No newline at end of file
+DECLARE_REF(Model)
+
+// placement of one of the models of a group
+struct ModelInstance
+{
+  uint32_t model;
+  glm::mat4 transform;
+};
+
+// contents of a file, every mesh is stored once and placed by the instances
+struct ModelGroup
+{
+  std::vector<PModel> models;
+  std::vector<ModelInstance> instances;
+  std::vector<Material> materials;
+};
\ No newline at end of file
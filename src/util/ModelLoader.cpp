@@ -1,43 +1,169 @@
 #include "ModelLoader.h"
+#include "GltfLoader.h"
+#include "ObjLoader.h"
+#include "Trace.h"
 #include <assimp/Importer.hpp>
 #include <assimp/config.h>
 #include <assimp/material.h>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
 
-std::vector<PModel> ModelLoader::loadModel(std::string_view filename)
+ModelGroup ModelLoader::loadModel(std::string_view filename)
 {
-  Assimp::Importer importer;
-  const aiScene* scene = importer.ReadFile(std::string(filename), aiProcess_Triangulate | aiProcess_GenNormals);
-  std::cout << importer.GetErrorString() << std::endl;
-  std::vector<PModel> result;
-  for (int m = 0; m < scene->mNumMeshes; ++m)
+  ThreadPool pool(ThreadPool::defaultNumWorkers());
+  return loadModel(filename, pool);
+}
+
+ModelGroup ModelLoader::loadModel(std::string_view filename, ThreadPool& pool)
+{
+  return std::move(loadModels({std::string(filename)}, pool)[0]);
+}
+
+std::vector<ModelGroup> ModelLoader::loadModels(const std::vector<std::string>& filenames, ThreadPool& pool, bool native)
+{
+  TRACE_SCOPE("ModelLoader::loadModels");
+  std::vector<ModelGroup> result(filenames.size());
+  // the native loaders parallelize over the pool themselves, so they run one file after another on this thread
+  std::vector<bool> loaded(filenames.size());
+  for (size_t i = 0; i < filenames.size(); ++i)
   {
-    PModel model = std::make_unique<Model>();
-    const aiMesh* mesh = scene->mMeshes[m];
-    AABB aabb;
-    for (int v = 0; v < mesh->mNumVertices; ++v)
+    loaded[i] = native && loadNative(filenames[i], pool, result[i]);
+  }
+
+  // everything else goes through assimp, every file gets its own importer, they are not thread safe
+  std::vector<Assimp::Importer> importers(filenames.size());
+  std::vector<const aiScene*> scenes(filenames.size());
+  pool.parallelFor(filenames.size(), 1,
+                   [&](size_t begin, size_t end)
+                   {
+                     for (size_t i = begin; i < end; ++i)
+                     {
+                       if (loaded[i])
+                         continue;
+                       TRACE_SCOPE("Assimp::Importer::ReadFile");
+                       // texture coordinates have their origin at the top left, as in gltf and the obj loader
+                       scenes[i] = importers[i].ReadFile(filenames[i], aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_FlipUVs);
+                       if (scenes[i] == nullptr)
+                       {
+                         std::cout << filenames[i] << ": " << importers[i].GetErrorString() << std::endl;
+                       }
+                     }
+                   });
+
+  std::vector<std::pair<const aiMesh*, PModel*>> meshes;
+  for (size_t i = 0; i < filenames.size(); ++i)
+  {
+    if (scenes[i] == nullptr)
+      continue;
+    std::filesystem::path directory = std::filesystem::path(filenames[i]).parent_path();
+    for (uint32_t m = 0; m < scenes[i]->mNumMaterials; ++m)
+    {
+      result[i].materials.push_back(convertMaterial(scenes[i]->mMaterials[m], directory));
+    }
+    result[i].models.resize(scenes[i]->mNumMeshes);
+    for (uint32_t m = 0; m < scenes[i]->mNumMeshes; ++m)
     {
-      auto aiVert = mesh->mVertices[v];
-      model->positions.push_back(glm::vec3(aiVert.x, aiVert.y, aiVert.z));
-      if (mesh->HasTextureCoords(0))
-      {
-        model->texCoords.push_back(glm::vec2(mesh->mTextureCoords[0][v].x, mesh->mTextureCoords[0][v].y));
-      }
-      else
-      {
-        model->texCoords.push_back(glm::vec2(0, 0));
-      }
-      model->normals.push_back(glm::vec3(mesh->mNormals[v].x, mesh->mNormals[v].y, mesh->mNormals[v].z));
-      aabb.adjust(model->positions.back());
+      meshes.push_back({scenes[i]->mMeshes[m], &result[i].models[m]});
     }
-    for (int i = 0; i < mesh->mNumFaces; ++i)
+    addNode(scenes[i]->mRootNode, glm::mat4(1.0f), result[i]);
+  }
+  pool.parallelFor(meshes.size(), 1,
+                   [&](size_t begin, size_t end)
+                   {
+                     for (size_t i = begin; i < end; ++i)
+                     {
+                       *meshes[i].second = convertMesh(meshes[i].first);
+                     }
+                   });
+  return result;
+}
+
+bool ModelLoader::loadNative(std::string_view filename, ThreadPool& pool, ModelGroup& result)
+{
+  std::string extension = std::filesystem::path(filename).extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+  bool loaded = false;
+  if (extension == ".obj")
+    loaded = ObjLoader::load(filename, pool, result);
+  else if (extension == ".gltf" || extension == ".glb")
+    loaded = GltfLoader::load(filename, pool, result);
+  if (!loaded)
+    result = ModelGroup();
+  return loaded;
+}
+
+void ModelLoader::addNode(const aiNode* node, glm::mat4 parent, ModelGroup& result)
+{
+  // assimp matrices are row major
+  const aiMatrix4x4& m = node->mTransformation;
+  glm::mat4 transform = parent * glm::mat4(glm::vec4(m.a1, m.b1, m.c1, m.d1), glm::vec4(m.a2, m.b2, m.c2, m.d2), glm::vec4(m.a3, m.b3, m.c3, m.d3),
+                                           glm::vec4(m.a4, m.b4, m.c4, m.d4));
+  for (uint32_t i = 0; i < node->mNumMeshes; ++i)
+  {
+    result.instances.push_back(ModelInstance{
+        .model = node->mMeshes[i],
+        .transform = transform,
+    });
+  }
+  for (uint32_t c = 0; c < node->mNumChildren; ++c)
+  {
+    addNode(node->mChildren[c], transform, result);
+  }
+}
+
+PModel ModelLoader::convertMesh(const aiMesh* mesh)
+{
+  TRACE_SCOPE("ModelLoader::convertMesh");
+  PModel model = std::make_unique<Model>();
+  model->positions.resize(mesh->mNumVertices);
+  model->texCoords.resize(mesh->mNumVertices);
+  model->normals.resize(mesh->mNumVertices);
+  model->indices.resize(mesh->mNumFaces);
+  AABB aabb;
+  for (uint32_t v = 0; v < mesh->mNumVertices; ++v)
+  {
+    auto aiVert = mesh->mVertices[v];
+    model->positions[v] = glm::vec3(aiVert.x, aiVert.y, aiVert.z);
+    if (mesh->HasTextureCoords(0))
     {
-      auto face = mesh->mFaces[i];
-      model->indices.push_back(glm::uvec3(face.mIndices[0], face.mIndices[1], face.mIndices[2]));
+      model->texCoords[v] = glm::vec2(mesh->mTextureCoords[0][v].x, mesh->mTextureCoords[0][v].y);
     }
-    model->boundingBox = aabb;
-    result.push_back(std::move(model));
+    model->normals[v] = glm::vec3(mesh->mNormals[v].x, mesh->mNormals[v].y, mesh->mNormals[v].z);
+    aabb.adjust(model->positions[v]);
+  }
+  for (uint32_t i = 0; i < mesh->mNumFaces; ++i)
+  {
+    auto face = mesh->mFaces[i];
+    model->indices[i] = glm::uvec3(face.mIndices[0], face.mIndices[1], face.mIndices[2]);
   }
+  model->boundingBox = aabb;
+  model->material = mesh->mMaterialIndex;
+  return model;
+}
+
+Material ModelLoader::convertMaterial(const aiMaterial* material, const std::filesystem::path& directory)
+{
+  Material result;
+  aiColor3D color;
+  if (material->Get(AI_MATKEY_COLOR_DIFFUSE, color) == aiReturn_SUCCESS)
+    result.albedo = glm::vec3(color.r, color.g, color.b);
+  if (material->Get(AI_MATKEY_COLOR_SPECULAR, color) == aiReturn_SUCCESS)
+    result.specularColor = glm::vec3(color.r, color.g, color.b);
+  if (material->Get(AI_MATKEY_COLOR_EMISSIVE, color) == aiReturn_SUCCESS)
+    result.emissive = glm::vec3(color.r, color.g, color.b);
+  material->Get(AI_MATKEY_SHININESS, result.shininess);
+  auto texture = [&](aiTextureType type) -> std::string
+  {
+    aiString path;
+    // embedded textures are named "*<index>"
+    if (material->GetTextureCount(type) == 0 || material->GetTexture(type, 0, &path) != aiReturn_SUCCESS || path.C_Str()[0] == '*')
+      return {};
+    return (directory / path.C_Str()).string();
+  };
+  result.albedoTexture = texture(aiTextureType_DIFFUSE);
+  result.emissiveTexture = texture(aiTextureType_EMISSIVE);
   return result;
 }
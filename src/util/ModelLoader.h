@@ -1,10 +1,24 @@
 #pragma once
 #include "Model.h"
+#include "ThreadPool.h"
+#include <filesystem>
+#include <string>
 #include <string_view>
 
 class ModelLoader
 {
 public:
-	static std::vector<PModel> loadModel(std::string_view filename);
+	// every mesh of a file is converted once and placed by the node hierarchy of the file
+	static ModelGroup loadModel(std::string_view filename);
+	static ModelGroup loadModel(std::string_view filename, ThreadPool& pool);
+	// imports the files concurrently and converts all their meshes in one batch, one result per file
+	// obj and gltf files are read by the native loaders, assimp is the fallback for those and handles everything else
+	// native = false sends every file through assimp, for checking the native loaders against it
+	static std::vector<ModelGroup> loadModels(const std::vector<std::string>& filenames, ThreadPool& pool, bool native = true);
 private:
-};
\ No newline at end of file
+	static bool loadNative(std::string_view filename, ThreadPool& pool, ModelGroup& result);
+	static void addNode(const struct aiNode* node, glm::mat4 parent, ModelGroup& result);
+	static PModel convertMesh(const struct aiMesh* mesh);
+	// texture paths are resolved relative to directory, embedded textures are skipped
+	static Material convertMaterial(const struct aiMaterial* material, const std::filesystem::path& directory);
+};
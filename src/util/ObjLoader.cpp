@@ -0,0 +1,349 @@
+#include "ObjLoader.h"
+#include "MappedFile.h"
+#include "Trace.h"
+#include <atomic>
+#include <charconv>
+#include <iostream>
+
+// the file is split into chunks of roughly this size, cut at line ends
+static constexpr size_t CHUNK_BYTES = 1 << 20;
+static constexpr int64_t MISSING = -1;
+// a relative index that points before the first element
+static constexpr int64_t INVALID = -2;
+
+// absolute, zero based indices of a face corner
+struct ObjCorner
+{
+  int64_t position = MISSING;
+  int64_t texCoord = MISSING;
+  int64_t normal = MISSING;
+};
+
+struct ObjChunk
+{
+  std::string_view text;
+  size_t numPositions = 0;
+  size_t numTexCoords = 0;
+  size_t numNormals = 0;
+  size_t numTriangles = 0;
+  // elements of all previous chunks
+  size_t positionOffset = 0;
+  size_t texCoordOffset = 0;
+  size_t normalOffset = 0;
+  size_t triangleOffset = 0;
+};
+
+enum class ObjLine
+{
+  Position,
+  TexCoord,
+  Normal,
+  Face,
+  Other,
+};
+
+static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+static const char* skipSpace(const char* p, const char* end)
+{
+  while (p < end && isSpace(*p))
+    p++;
+  return p;
+}
+
+// classifies the line and moves p behind the keyword
+static ObjLine classify(const char*& p, const char* end)
+{
+  p = skipSpace(p, end);
+  if (end - p < 2)
+    return ObjLine::Other;
+  if (p[0] == 'v' && isSpace(p[1]))
+  {
+    p += 2;
+    return ObjLine::Position;
+  }
+  if (p[0] == 'f' && isSpace(p[1]))
+  {
+    p += 2;
+    return ObjLine::Face;
+  }
+  if (end - p >= 3 && p[0] == 'v' && isSpace(p[2]))
+  {
+    p += 3;
+    return p[-2] == 't' ? ObjLine::TexCoord : p[-2] == 'n' ? ObjLine::Normal : ObjLine::Other;
+  }
+  return ObjLine::Other;
+}
+
+template <typename Fn> static void forEachLine(std::string_view text, Fn fn)
+{
+  const char* p = text.data();
+  const char* end = text.data() + text.size();
+  while (p < end)
+  {
+    const char* lineEnd = std::find(p, end, '\n');
+    fn(p, lineEnd);
+    p = lineEnd + 1;
+  }
+}
+
+static size_t countCorners(const char* p, const char* end)
+{
+  size_t corners = 0;
+  while (true)
+  {
+    p = skipSpace(p, end);
+    if (p >= end)
+      return corners;
+    corners++;
+    while (p < end && !isSpace(*p))
+      p++;
+  }
+}
+
+template <int N> static glm::vec<N, float> parseVector(const char* p, const char* end)
+{
+  glm::vec<N, float> result(0.0f);
+  for (int i = 0; i < N; ++i)
+  {
+    p = skipSpace(p, end);
+    if (p < end && *p == '+')
+      p++;
+    p = std::from_chars(p, end, result[i]).ptr;
+  }
+  return result;
+}
+
+// one based or negative relative index to absolute, count is the number of elements defined so far
+static int64_t resolve(int64_t index, size_t count)
+{
+  if (index > 0)
+    return index - 1;
+  if (index < 0)
+    return (int64_t)count + index >= 0 ? (int64_t)count + index : INVALID;
+  return MISSING;
+}
+
+// parses v, v/vt, v//vn or v/vt/vn
+static const char* parseCorner(const char* p, const char* end, const ObjChunk& chunk, size_t numPositions, size_t numTexCoords,
+                               size_t numNormals, ObjCorner& corner)
+{
+  int64_t indices[3] = {0, 0, 0};
+  for (int i = 0; i < 3 && p < end && !isSpace(*p); ++i)
+  {
+    p = std::from_chars(p, end, indices[i]).ptr;
+    if (p < end && *p == '/')
+      p++;
+  }
+  while (p < end && !isSpace(*p))
+    p++;
+  corner.position = resolve(indices[0], chunk.positionOffset + numPositions);
+  corner.texCoord = resolve(indices[1], chunk.texCoordOffset + numTexCoords);
+  corner.normal = resolve(indices[2], chunk.normalOffset + numNormals);
+  return p;
+}
+
+bool ObjLoader::load(std::string_view filename, ThreadPool& pool, ModelGroup& result)
+{
+  TRACE_SCOPE("ObjLoader::load");
+  MappedFile file(filename);
+  if (!file.isOpen())
+    return false;
+  std::string_view text = file.view();
+
+  std::vector<ObjChunk> chunks;
+  for (size_t begin = 0; begin < text.size();)
+  {
+    size_t end = std::min(begin + CHUNK_BYTES, text.size());
+    end = std::min(text.find('\n', end), text.size());
+    chunks.push_back(ObjChunk{.text = text.substr(begin, end - begin)});
+    begin = end + 1;
+  }
+
+  // first pass counts, so every chunk knows where its elements go
+  pool.parallelFor(chunks.size(), 1,
+                   [&](size_t begin, size_t end)
+                   {
+                     for (size_t c = begin; c < end; ++c)
+                     {
+                       ObjChunk& chunk = chunks[c];
+                       forEachLine(chunk.text,
+                                   [&](const char* p, const char* lineEnd)
+                                   {
+                                     switch (classify(p, lineEnd))
+                                     {
+                                     case ObjLine::Position:
+                                       chunk.numPositions++;
+                                       break;
+                                     case ObjLine::TexCoord:
+                                       chunk.numTexCoords++;
+                                       break;
+                                     case ObjLine::Normal:
+                                       chunk.numNormals++;
+                                       break;
+                                     case ObjLine::Face:
+                                       chunk.numTriangles += std::max(countCorners(p, lineEnd), size_t(2)) - 2;
+                                       break;
+                                     default:
+                                       break;
+                                     }
+                                   });
+                     }
+                   });
+  size_t numPositions = 0, numTexCoords = 0, numNormals = 0, numTriangles = 0;
+  for (auto& chunk : chunks)
+  {
+    chunk.positionOffset = numPositions;
+    chunk.texCoordOffset = numTexCoords;
+    chunk.normalOffset = numNormals;
+    chunk.triangleOffset = numTriangles;
+    numPositions += chunk.numPositions;
+    numTexCoords += chunk.numTexCoords;
+    numNormals += chunk.numNormals;
+    numTriangles += chunk.numTriangles;
+  }
+  if (numTriangles == 0)
+  {
+    std::cout << filename << ": no faces" << std::endl;
+    return false;
+  }
+
+  std::vector<glm::vec3> positions(numPositions);
+  std::vector<glm::vec2> texCoords(numTexCoords);
+  std::vector<glm::vec3> normals(numNormals);
+  std::vector<ObjCorner> corners(numTriangles * 3);
+  std::atomic_bool valid = true;
+  pool.parallelFor(chunks.size(), 1,
+                   [&](size_t begin, size_t end)
+                   {
+                     for (size_t c = begin; c < end; ++c)
+                     {
+                       TRACE_SCOPE("ObjLoader::parseChunk");
+                       const ObjChunk& chunk = chunks[c];
+                       size_t p = 0, t = 0, n = 0, f = 0;
+                       forEachLine(chunk.text,
+                                   [&](const char* it, const char* lineEnd)
+                                   {
+                                     switch (classify(it, lineEnd))
+                                     {
+                                     case ObjLine::Position:
+                                       positions[chunk.positionOffset + p++] = parseVector<3>(it, lineEnd);
+                                       break;
+                                     case ObjLine::TexCoord:
+                                     {
+                                       // obj puts the origin at the bottom left, the textures are sampled from the top left
+                                       glm::vec2 texCoord = parseVector<2>(it, lineEnd);
+                                       texCoords[chunk.texCoordOffset + t++] = glm::vec2(texCoord.x, 1 - texCoord.y);
+                                       break;
+                                     }
+                                     case ObjLine::Normal:
+                                       normals[chunk.normalOffset + n++] = parseVector<3>(it, lineEnd);
+                                       break;
+                                     case ObjLine::Face:
+                                     {
+                                       // triangle fan around the first corner
+                                       ObjCorner first, previous, current;
+                                       for (size_t i = 0;; ++i)
+                                       {
+                                         it = skipSpace(it, lineEnd);
+                                         if (it >= lineEnd)
+                                           break;
+                                         it = parseCorner(it, lineEnd, chunk, p, t, n, current);
+                                         if (current.position < 0 || current.position >= (int64_t)numPositions ||
+                                             current.texCoord == INVALID || current.texCoord >= (int64_t)numTexCoords ||
+                                             current.normal == INVALID || current.normal >= (int64_t)numNormals)
+                                         {
+                                           valid = false;
+                                         }
+                                         if (i == 0)
+                                           first = current;
+                                         else if (i >= 2)
+                                         {
+                                           ObjCorner* triangle = &corners[(chunk.triangleOffset + f++) * 3];
+                                           triangle[0] = first;
+                                           triangle[1] = previous;
+                                           triangle[2] = current;
+                                         }
+                                         previous = current;
+                                       }
+                                       break;
+                                     }
+                                     default:
+                                       break;
+                                     }
+                                   });
+                     }
+                   });
+  if (!valid)
+  {
+    std::cout << filename << ": face index out of range" << std::endl;
+    return false;
+  }
+
+  // vertices can be shared if every corner uses the same index for all its attributes
+  bool shared = true;
+  for (const auto& corner : corners)
+  {
+    shared &= (corner.texCoord == MISSING || corner.texCoord == corner.position) && (corner.normal == MISSING || corner.normal == corner.position);
+  }
+  bool hasNormals = numNormals > 0 && std::all_of(corners.begin(), corners.end(), [](const ObjCorner& c) { return c.normal != MISSING; });
+
+  PModel model = std::make_unique<Model>();
+  model->indices.resize(numTriangles);
+  if (shared)
+  {
+    model->positions = std::move(positions);
+    model->texCoords.resize(numPositions);
+    if (numTexCoords > 0)
+    {
+      std::copy_n(texCoords.begin(), std::min(numTexCoords, numPositions), model->texCoords.begin());
+    }
+    if (hasNormals)
+    {
+      model->normals.resize(numPositions);
+      std::copy_n(normals.begin(), std::min(numNormals, numPositions), model->normals.begin());
+    }
+    for (size_t i = 0; i < numTriangles; ++i)
+    {
+      model->indices[i] = glm::uvec3(corners[i * 3].position, corners[i * 3 + 1].position, corners[i * 3 + 2].position);
+    }
+  }
+  else
+  {
+    // every corner becomes its own vertex, like assimp does for obj
+    model->positions.resize(corners.size());
+    model->texCoords.resize(corners.size());
+    model->normals.resize(hasNormals ? corners.size() : 0);
+    pool.parallelFor(numTriangles, 1 << 16,
+                     [&](size_t begin, size_t end)
+                     {
+                       for (size_t v = begin * 3; v < end * 3; ++v)
+                       {
+                         const ObjCorner& corner = corners[v];
+                         model->positions[v] = positions[corner.position];
+                         model->texCoords[v] = corner.texCoord == MISSING ? glm::vec2(0) : texCoords[corner.texCoord];
+                         if (hasNormals)
+                           model->normals[v] = normals[corner.normal];
+                       }
+                       for (size_t i = begin; i < end; ++i)
+                       {
+                         model->indices[i] = glm::uvec3(i * 3, i * 3 + 1, i * 3 + 2);
+                       }
+                     });
+  }
+  if (!hasNormals)
+  {
+    model->generateNormals();
+  }
+  else
+  {
+    model->repairNormals();
+  }
+  model->computeBounds();
+  result.instances.push_back(ModelInstance{
+      .model = (uint32_t)result.models.size(),
+      .transform = glm::mat4(1.0f),
+  });
+  result.models.push_back(std::move(model));
+  return true;
+}
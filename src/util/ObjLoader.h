@@ -0,0 +1,13 @@
+#pragma once
+#include "Model.h"
+#include "ThreadPool.h"
+#include <string_view>
+
+// wavefront obj reader that parses chunks of the mapped file in parallel
+// groups and materials are ignored, the whole file becomes one model
+class ObjLoader
+{
+public:
+  // false if the file could not be read or uses something this loader does not understand
+  static bool load(std::string_view filename, ThreadPool& pool, ModelGroup& result);
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include <cmath>
+#include <glm/glm.hpp>
+
+// compact encodings of the vertex attributes in the scene pools
+// Compute.metal decodes the same formats
+
+// octahedral mapping onto two 16 bit snorms
+inline uint32_t encodeNormal(glm::vec3 n)
+{
+  // a zero normal would divide by zero, the loaders repair them, this keeps the pools free of NaN regardless
+  float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  n = sum > 0 ? n / sum : glm::vec3(0, 0, 1);
+  glm::vec2 p = glm::vec2(n.x, n.y);
+  if (n.z < 0)
+  {
+    // fold the lower hemisphere over the diagonals
+    p = glm::vec2((1 - std::abs(n.y)) * (n.x >= 0 ? 1.0f : -1.0f), (1 - std::abs(n.x)) * (n.y >= 0 ? 1.0f : -1.0f));
+  }
+  return glm::packSnorm2x16(p);
+}
+
+inline glm::vec3 decodeNormal(uint32_t encoded)
+{
+  glm::vec2 p = glm::unpackSnorm2x16(encoded);
+  glm::vec3 n = glm::vec3(p.x, p.y, 1 - std::abs(p.x) - std::abs(p.y));
+  float t = std::max(-n.z, 0.0f);
+  n.x += n.x >= 0 ? -t : t;
+  n.y += n.y >= 0 ? -t : t;
+  return glm::normalize(n);
+}
+
+// half precision, 11 significant bits
+inline uint32_t encodeTexCoord(glm::vec2 t) { return glm::packHalf2x16(t); }
+inline glm::vec2 decodeTexCoord(uint32_t encoded) { return glm::unpackHalf2x16(encoded); }
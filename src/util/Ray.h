@@ -1,13 +1,41 @@
 #pragma once
+#include <cmath>
 #include <glm/glm.hpp>
+#include <numbers>
+
+inline glm::vec3 rand01(glm::uvec3 x)
+{ // pseudo-random number generator
+  for (int i = 3; i-- > 0;)
+    x = ((x >> 8U) ^ glm::uvec3(x.y, x.z, x.x)) * 1103515245U;
+  return glm::vec3(x) * (1.0f / float(0xffffffffU));
+}
+
+// cosine weighted direction around the normal w
+inline glm::vec3 sampleHemisphere(glm::vec3 w, glm::vec2 rnd01)
+{
+  float r1 = 2 * std::numbers::pi * rnd01.x;
+  float r2 = rnd01.y;
+  float r2s = std::sqrt(r2);
+  glm::vec3 u = glm::normalize(glm::cross(std::abs(w.x) > 0.1 ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0), w));
+  glm::vec3 v = glm::cross(w, u);
+  return glm::normalize(u * std::cos(r1) * r2s + v * std::sin(r1) * r2s + w * std::sqrt(1 - r2));
+}
 
 struct Payload
 {
   glm::vec3 rnd01;
+  // integer state rnd01 was hashed from, usually pixel and sample, the later random decisions of the path are hashed from it too
+  glm::uvec3 seed = glm::uvec3(0);
   glm::vec3 accumulatedRadiance = glm::vec3(0);
   glm::vec3 accumulatedMaterial = glm::vec3(1);
   uint32_t depth = 0;
-  float emissive = 1;
+  // distance to the first hit along the camera ray
+  float hitDistance = std::numeric_limits<float>::max();
+  // ray cone of the path, width at the origin of the current ray and spread angle, for texture lod
+  float coneWidth = 0;
+  float coneSpread = 0;
+  // solid angle density the direction of the current ray was sampled with, zero for camera rays
+  float bouncePdf = 0;
 };
 
 struct Ray
@@ -25,4 +53,7 @@ struct HitInfo
   // its the normal being flipped based on some dot product
   glm::vec3 normalLight;
   glm::vec2 texCoords;
+  // mip level of a texture with a single texel, TextureCache::sample adds the size of the actual one
+  // the intersection sets the texture to world area ratio of the triangle, traceRay adds the ray cone footprint
+  float lod = 0;
 };
\ No newline at end of file
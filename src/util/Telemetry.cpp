@@ -0,0 +1,73 @@
+#include "Telemetry.h"
+
+std::mutex Telemetry::threadsLock;
+std::vector<std::unique_ptr<RayCounters>> Telemetry::threads;
+std::vector<RayCounters*> Telemetry::unused;
+
+RayStats RayStats::operator-(const RayStats& other) const
+{
+  RayStats result;
+  for (size_t i = 0; i < counters.size(); ++i)
+  {
+    result.counters[i] = counters[i] - other.counters[i];
+  }
+  for (size_t i = 0; i < pathLengths.size(); ++i)
+  {
+    result.pathLengths[i] = pathLengths[i] - other.pathLengths[i];
+  }
+  return result;
+}
+
+void RayStats::writeJson(std::ostream& out) const
+{
+  out << "{";
+  for (size_t i = 0; i < counters.size(); ++i)
+  {
+    out << "\"" << Telemetry::counterName(Counter(i)) << "\": " << counters[i] << ", ";
+  }
+  out << "\"pathLengths\": [";
+  for (size_t i = 0; i < pathLengths.size(); ++i)
+  {
+    out << (i > 0 ? ", " : "") << pathLengths[i];
+  }
+  out << "]}";
+}
+
+RayStats Telemetry::collect()
+{
+  RayStats result;
+  std::unique_lock l(threadsLock);
+  for (const auto& thread : threads)
+  {
+    for (size_t i = 0; i < result.counters.size(); ++i)
+    {
+      result.counters[i] += thread->counters[i].load(std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < result.pathLengths.size(); ++i)
+    {
+      result.pathLengths[i] += thread->pathLengths[i].load(std::memory_order_relaxed);
+    }
+  }
+  return result;
+}
+
+RayCounters* Telemetry::acquire()
+{
+  // counters outlive their thread so finished workers still show up in the totals
+  std::unique_lock l(threadsLock);
+  if (!unused.empty())
+  {
+    RayCounters* counters = unused.back();
+    unused.pop_back();
+    return counters;
+  }
+  threads.push_back(std::make_unique<RayCounters>());
+  return threads.back().get();
+}
+
+void Telemetry::release(RayCounters* counters)
+{
+  // the lock orders the last writes of the old thread before the first ones of the next
+  std::unique_lock l(threadsLock);
+  unused.push_back(counters);
+}
@@ -0,0 +1,179 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// depth at which traceRay stops following a path
+static constexpr uint32_t MAX_PATH_LENGTH = 12;
+
+enum class Counter
+{
+  PrimaryRays,
+  BounceRays,
+  ShadowRays,
+  NodesVisited,
+  AABBTests,
+  TriangleTests,
+  // ray tests against analytic primitives
+  PrimitiveTests,
+  // bottom level hierarchies built on demand and the time spent on them
+  HierarchyBuilds,
+  HierarchyBuildMicroseconds,
+  // shadow rays tested against the last occluder of their light first, and how many of them it blocked
+  OccluderCacheLookups,
+  OccluderCacheHits,
+  // paths that reached the depth of the radiance cache, and how many of them ended with its estimate
+  RadianceCacheLookups,
+  RadianceCacheHits,
+  NumCounters,
+};
+
+// counters of a single thread, only the owning thread writes them
+// so an increment is a plain load and store instead of a locked add
+struct RayCounters
+{
+  std::array<std::atomic<uint64_t>, (size_t)Counter::NumCounters> counters = {};
+  std::array<std::atomic<uint64_t>, MAX_PATH_LENGTH + 1> pathLengths = {};
+  void add(Counter counter, uint64_t n = 1)
+  {
+    auto& value = counters[(size_t)counter];
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+  void addPath(uint32_t length)
+  {
+    auto& value = pathLengths[std::min(length, MAX_PATH_LENGTH)];
+    value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+};
+
+// counters of all threads summed up
+struct RayStats
+{
+  std::array<uint64_t, (size_t)Counter::NumCounters> counters = {};
+  std::array<uint64_t, MAX_PATH_LENGTH + 1> pathLengths = {};
+  uint64_t operator[](Counter counter) const { return counters[(size_t)counter]; }
+  uint64_t totalRays() const
+  {
+    return counters[(size_t)Counter::PrimaryRays] + counters[(size_t)Counter::BounceRays] + counters[(size_t)Counter::ShadowRays];
+  }
+  RayStats operator-(const RayStats& other) const;
+  void writeJson(std::ostream& out) const;
+};
+
+// fixed size time series, written by one thread and read by another
+// the values are few, so every access takes the lock and readers work on a copy
+template <typename T, size_t N> class RingBuffer
+{
+public:
+  void push(T value)
+  {
+    std::lock_guard l(lock);
+    values[head % N] = value;
+    head++;
+  }
+  void clear()
+  {
+    std::lock_guard l(lock);
+    head = 0;
+  }
+  size_t size() const
+  {
+    std::lock_guard l(lock);
+    return std::min(head, N);
+  }
+  bool empty() const { return size() == 0; }
+  // oldest first
+  std::vector<T> snapshot() const
+  {
+    std::lock_guard l(lock);
+    size_t n = std::min(head, N);
+    size_t first = head < N ? 0 : head % N;
+    std::vector<T> result(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+      result[i] = values[(first + i) % N];
+    }
+    return result;
+  }
+  T back() const
+  {
+    std::lock_guard l(lock);
+    return head == 0 ? T() : values[(head - 1) % N];
+  }
+  T mean() const
+  {
+    std::vector<T> v = snapshot();
+    T sum = T();
+    for (T value : v)
+    {
+      sum += value;
+    }
+    return v.empty() ? T() : sum / T(v.size());
+  }
+  // p in [0, 1]
+  T percentile(float p) const
+  {
+    std::vector<T> sorted = snapshot();
+    size_t n = sorted.size();
+    if (n == 0)
+      return T();
+    auto nth = sorted.begin() + std::min(size_t(p * (n - 1) + 0.5f), n - 1);
+    std::nth_element(sorted.begin(), nth, sorted.end());
+    return *nth;
+  }
+  void writeJson(std::ostream& out) const
+  {
+    out << "{\"last\": " << back() << ", \"mean\": " << mean() << ", \"p50\": " << percentile(0.5f) << ", \"p90\": " << percentile(0.9f)
+        << ", \"p99\": " << percentile(0.99f) << "}";
+  }
+
+private:
+  std::array<T, N> values = {};
+  size_t head = 0;
+  mutable std::mutex lock;
+};
+
+class Telemetry
+{
+public:
+  // counters of the calling thread, registered on first use
+  static RayCounters& local()
+  {
+    thread_local ThreadCounters counters;
+    return *counters.counters;
+  }
+  static RayStats collect();
+  static constexpr std::string_view counterName(Counter counter)
+  {
+    constexpr std::array<std::string_view, (size_t)Counter::NumCounters> names = {
+        "primaryRays",     "bounceRays",
+        "shadowRays",      "nodesVisited",
+        "aabbTests",       "triangleTests",
+        "primitiveTests",  "hierarchyBuilds",
+        "hierarchyBuildMicroseconds", "occluderCacheLookups",
+        "occluderCacheHits",          "radianceCacheLookups",
+        "radianceCacheHits",
+    };
+    return names[(size_t)counter];
+  }
+
+private:
+  // hands the counters back when its thread exits, the next new thread continues counting on them
+  struct ThreadCounters
+  {
+    RayCounters* counters = acquire();
+    ~ThreadCounters() { release(counters); }
+  };
+  static RayCounters* acquire();
+  static void release(RayCounters* counters);
+  static std::mutex threadsLock;
+  // every counters ever handed out, and those whose thread has exited
+  static std::vector<std::unique_ptr<RayCounters>> threads;
+  static std::vector<RayCounters*> unused;
+};
@@ -0,0 +1,273 @@
+#include "TextureCache.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <ktx.h>
+#include <stb_image.h>
+#include <string>
+
+// the only formats the tiles can be copied from without decoding
+static constexpr uint32_t VK_FORMAT_R8G8B8A8_UNORM = 37;
+static constexpr uint32_t VK_FORMAT_R8G8B8A8_SRGB = 43;
+// the level index directly follows the fixed size header of a KTX2 file
+static constexpr size_t KTX2_LEVEL_INDEX_OFFSET = 80;
+
+struct Ktx2Level
+{
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint64_t uncompressedByteLength;
+};
+
+// half size, box filtered, odd sizes drop their last row or column
+static std::vector<uint32_t> downsample(const std::vector<uint32_t>& texels, uint32_t width, uint32_t height)
+{
+  uint32_t w = std::max(width / 2, 1u);
+  uint32_t h = std::max(height / 2, 1u);
+  std::vector<uint32_t> result(w * h);
+  for (uint32_t y = 0; y < h; ++y)
+  {
+    for (uint32_t x = 0; x < w; ++x)
+    {
+      uint32_t x1 = std::min(2 * x + 1, width - 1);
+      uint32_t y1 = std::min(2 * y + 1, height - 1);
+      glm::vec4 sum = glm::unpackUnorm4x8(texels[2 * y * width + 2 * x]) + glm::unpackUnorm4x8(texels[2 * y * width + x1]) +
+                      glm::unpackUnorm4x8(texels[y1 * width + 2 * x]) + glm::unpackUnorm4x8(texels[y1 * width + x1]);
+      result[y * w + x] = glm::packUnorm4x8(sum * 0.25f);
+    }
+  }
+  return result;
+}
+
+// writes image with a full mip chain as an rgba8 KTX2 file
+static bool convertToKtx2(std::string_view image, const std::string& ktx2)
+{
+  TRACE_SCOPE("convertToKtx2");
+  int x, y, n;
+  auto* data = stbi_load(std::string(image).c_str(), &x, &y, &n, 4);
+  if (data == nullptr)
+  {
+    std::cout << "Could not load " << image << std::endl;
+    return false;
+  }
+  std::vector<uint32_t> texels(x * y);
+  std::memcpy(texels.data(), data, texels.size() * sizeof(uint32_t));
+  stbi_image_free(data);
+
+  uint32_t width = x;
+  uint32_t height = y;
+  ktxTextureCreateInfo info = {};
+  info.vkFormat = VK_FORMAT_R8G8B8A8_UNORM;
+  info.baseWidth = width;
+  info.baseHeight = height;
+  info.baseDepth = 1;
+  info.numDimensions = 2;
+  info.numLevels = (uint32_t)std::floor(std::log2(std::max(width, height))) + 1;
+  info.numLayers = 1;
+  info.numFaces = 1;
+  info.isArray = KTX_FALSE;
+  info.generateMipmaps = KTX_FALSE;
+  ktxTexture2* texture = nullptr;
+  if (ktxTexture2_Create(&info, KTX_TEXTURE_CREATE_ALLOC_STORAGE, &texture) != KTX_SUCCESS)
+  {
+    std::cout << "Could not create " << ktx2 << std::endl;
+    return false;
+  }
+  for (uint32_t level = 0; level < info.numLevels; ++level)
+  {
+    ktxTexture_SetImageFromMemory(ktxTexture(texture), level, 0, 0, (const ktx_uint8_t*)texels.data(), texels.size() * sizeof(uint32_t));
+    texels = downsample(texels, width, height);
+    width = std::max(width / 2, 1u);
+    height = std::max(height / 2, 1u);
+  }
+  bool written = ktxTexture_WriteToNamedFile(ktxTexture(texture), ktx2.c_str()) == KTX_SUCCESS;
+  ktxTexture2_Destroy(texture);
+  if (!written)
+    std::cout << "Could not write " << ktx2 << std::endl;
+  return written;
+}
+
+TextureCache::~TextureCache()
+{
+  for (const CachedTexture& texture : textures)
+  {
+    for (size_t i = 0; i < texture.numTiles; ++i)
+    {
+      delete texture.tiles[i].load(std::memory_order_relaxed);
+    }
+  }
+}
+
+uint32_t TextureCache::addTexture(std::string_view filename)
+{
+  std::filesystem::path path = std::filesystem::path(filename);
+  std::string extension = path.extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+  std::string ktx2 = std::string(filename);
+  if (extension != ".ktx2")
+  {
+    // the conversion is kept next to the image and reused until the image changes
+    ktx2 += ".ktx2";
+    std::error_code error;
+    if (!std::filesystem::exists(ktx2, error) ||
+        std::filesystem::last_write_time(ktx2, error) < std::filesystem::last_write_time(path, error))
+    {
+      if (!convertToKtx2(filename, ktx2))
+        return INVALID_TEXTURE;
+    }
+  }
+
+  CachedTexture texture;
+  texture.file = std::make_unique<MappedFile>(ktx2);
+  if (!texture.file->isOpen())
+    return INVALID_TEXTURE;
+  // the header only, the texels stay in the file until a tile needs them
+  ktxTexture2* header = nullptr;
+  if (ktxTexture2_CreateFromMemory((const ktx_uint8_t*)texture.file->getData(), texture.file->getSize(), KTX_TEXTURE_CREATE_NO_FLAGS,
+                                   &header) != KTX_SUCCESS)
+  {
+    std::cout << "Could not read " << ktx2 << std::endl;
+    return INVALID_TEXTURE;
+  }
+  bool supported = (header->vkFormat == VK_FORMAT_R8G8B8A8_UNORM || header->vkFormat == VK_FORMAT_R8G8B8A8_SRGB) &&
+                   header->supercompressionScheme == KTX_SS_NONE;
+  texture.width = header->baseWidth;
+  texture.height = header->baseHeight;
+  uint32_t numLevels = std::max(header->numLevels, 1u);
+  ktxTexture2_Destroy(header);
+  if (!supported || KTX2_LEVEL_INDEX_OFFSET + numLevels * sizeof(Ktx2Level) > texture.file->getSize())
+  {
+    std::cout << ktx2 << " is not an uncompressed rgba8 texture" << std::endl;
+    return INVALID_TEXTURE;
+  }
+
+  texture.numTiles = 0;
+  for (uint32_t l = 0; l < numLevels; ++l)
+  {
+    Ktx2Level index;
+    std::memcpy(&index, texture.file->getData() + KTX2_LEVEL_INDEX_OFFSET + l * sizeof(Ktx2Level), sizeof(Ktx2Level));
+    Level level = Level{
+        .width = std::max(texture.width >> l, 1u),
+        .height = std::max(texture.height >> l, 1u),
+        .fileOffset = index.byteOffset,
+        .firstTile = texture.numTiles,
+    };
+    if (index.byteOffset + (uint64_t)level.width * level.height * sizeof(uint32_t) > texture.file->getSize())
+    {
+      std::cout << ktx2 << " is truncated" << std::endl;
+      return INVALID_TEXTURE;
+    }
+    level.tilesPerRow = (level.width + TILE_SIZE - 1) / TILE_SIZE;
+    texture.numTiles += (size_t)level.tilesPerRow * ((level.height + TILE_SIZE - 1) / TILE_SIZE);
+    texture.levels.push_back(level);
+  }
+  texture.tiles = std::make_unique<std::atomic<Tile*>[]>(texture.numTiles);
+  textures.push_back(std::move(texture));
+  return (uint32_t)textures.size() - 1;
+}
+
+TextureCache::Tile* TextureCache::loadTile(const CachedTexture& texture, const Level& level, uint32_t tx, uint32_t ty) const
+{
+  Tile* tile = new Tile;
+  tile->lastUse.store(epoch, std::memory_order_relaxed);
+  const char* texels = texture.file->getData() + level.fileOffset;
+  for (uint32_t row = 0; row < TILE_SIZE; ++row)
+  {
+    uint32_t y = std::min(ty * TILE_SIZE + row, level.height - 1);
+    for (uint32_t column = 0; column < TILE_SIZE; ++column)
+    {
+      uint32_t x = std::min(tx * TILE_SIZE + column, level.width - 1);
+      std::memcpy(&tile->texels[row * TILE_SIZE + column], texels + ((size_t)y * level.width + x) * sizeof(uint32_t), sizeof(uint32_t));
+    }
+  }
+  // two threads may miss the same tile, the first one to publish it wins
+  std::atomic<Tile*>& slot = texture.tiles[level.firstTile + ty * level.tilesPerRow + tx];
+  Tile* expected = nullptr;
+  if (!slot.compare_exchange_strong(expected, tile, std::memory_order_acq_rel))
+  {
+    delete tile;
+    return expected;
+  }
+  residentBytes.fetch_add(sizeof(Tile), std::memory_order_relaxed);
+  if (!readFiles.load(std::memory_order_relaxed))
+    readFiles.store(true, std::memory_order_relaxed);
+  return tile;
+}
+
+uint32_t TextureCache::texel(const CachedTexture& texture, const Level& level, uint32_t x, uint32_t y) const
+{
+  uint32_t tx = x / TILE_SIZE;
+  uint32_t ty = y / TILE_SIZE;
+  Tile* tile = texture.tiles[level.firstTile + ty * level.tilesPerRow + tx].load(std::memory_order_acquire);
+  if (tile == nullptr)
+    tile = loadTile(texture, level, tx, ty);
+  else if (tile->lastUse.load(std::memory_order_relaxed) != epoch)
+    tile->lastUse.store(epoch, std::memory_order_relaxed);
+  return tile->texels[(y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE];
+}
+
+glm::vec3 TextureCache::sample(uint32_t index, glm::vec2 texCoords, float lod) const
+{
+  const CachedTexture& texture = textures[index];
+  // lod is the footprint of a texture with a single texel, a larger texture covers it with more of them
+  // degenerate triangles give infinite or nan lods, which end up in the first or last level
+  float l = std::min(lod + 0.5f * std::log2(float(texture.width) * float(texture.height)), float(texture.levels.size() - 1));
+  const Level& level = texture.levels[l > 0 ? (size_t)(l + 0.5f) : 0];
+  glm::vec2 p = glm::fract(texCoords) * glm::vec2(level.width, level.height) - 0.5f;
+  glm::vec2 base = glm::floor(p);
+  glm::vec2 f = p - base;
+  uint32_t x0 = ((int)base.x + level.width) % level.width;
+  uint32_t y0 = ((int)base.y + level.height) % level.height;
+  uint32_t x1 = (x0 + 1) % level.width;
+  uint32_t y1 = (y0 + 1) % level.height;
+  glm::vec3 t00 = glm::vec3(glm::unpackUnorm4x8(texel(texture, level, x0, y0)));
+  glm::vec3 t10 = glm::vec3(glm::unpackUnorm4x8(texel(texture, level, x1, y0)));
+  glm::vec3 t01 = glm::vec3(glm::unpackUnorm4x8(texel(texture, level, x0, y1)));
+  glm::vec3 t11 = glm::vec3(glm::unpackUnorm4x8(texel(texture, level, x1, y1)));
+  return glm::mix(glm::mix(t00, t10, f.x), glm::mix(t01, t11, f.x), f.y);
+}
+
+void TextureCache::trim()
+{
+  TRACE_SCOPE("TextureCache::trim");
+  // the tiles hold copies of everything the pass read, so the page cache would only keep a second one alive
+  if (readFiles.exchange(false, std::memory_order_relaxed))
+  {
+    for (const CachedTexture& texture : textures)
+    {
+      texture.file->evict(0, texture.file->getSize());
+    }
+  }
+  if (residentBytes.load(std::memory_order_relaxed) > budget)
+  {
+    struct Resident
+    {
+      uint64_t lastUse;
+      std::atomic<Tile*>* slot;
+    };
+    std::vector<Resident> resident;
+    for (const CachedTexture& texture : textures)
+    {
+      for (size_t i = 0; i < texture.numTiles; ++i)
+      {
+        Tile* tile = texture.tiles[i].load(std::memory_order_relaxed);
+        if (tile != nullptr)
+          resident.push_back(Resident{tile->lastUse.load(std::memory_order_relaxed), &texture.tiles[i]});
+      }
+    }
+    std::sort(resident.begin(), resident.end(), [](const Resident& a, const Resident& b) { return a.lastUse < b.lastUse; });
+    // nothing samples between passes, so the tiles can be freed right away
+    for (const Resident& r : resident)
+    {
+      // the working set of the last pass stays, even if it alone is over the budget
+      if (residentBytes.load(std::memory_order_relaxed) <= budget || r.lastUse == epoch)
+        break;
+      delete r.slot->exchange(nullptr, std::memory_order_relaxed);
+      residentBytes.fetch_sub(sizeof(Tile), std::memory_order_relaxed);
+    }
+  }
+  epoch++;
+}
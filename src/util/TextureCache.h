@@ -0,0 +1,68 @@
+#pragma once
+#include "MappedFile.h"
+#include <atomic>
+#include <glm/glm.hpp>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// textures read tile by tile and level by level on first use, from uncompressed rgba8 KTX2 files
+// png and jpg files are converted to a KTX2 file with a mip chain next to them once
+// lookups are lock free, the thread that misses a tile reads it from the mapped file
+// the tiles least recently used are evicted between passes once the cache is over its budget
+// the budget counts the tiles only, the mapped file pages they were copied from are dropped at the end of every pass
+class TextureCache
+{
+public:
+  static constexpr uint32_t TILE_SIZE = 32;
+  static constexpr uint32_t INVALID_TEXTURE = ~0u;
+  TextureCache(uint64_t budget = 256ull << 20) : budget(budget) {}
+  ~TextureCache();
+  TextureCache(const TextureCache&) = delete;
+  TextureCache& operator=(const TextureCache&) = delete;
+  // not thread safe, no sample may run meanwhile
+  uint32_t addTexture(std::string_view filename);
+  uint32_t getNumTextures() const { return (uint32_t)textures.size(); }
+  // bilinear with repeat addressing, lod as in HitInfo::lod
+  glm::vec3 sample(uint32_t texture, glm::vec2 texCoords, float lod) const;
+  // starts a new pass, no sample may run meanwhile
+  void trim();
+  void setBudget(uint64_t bytes) { budget = bytes; }
+  uint64_t getBudget() const { return budget; }
+  uint64_t getResidentBytes() const { return residentBytes.load(std::memory_order_relaxed); }
+
+private:
+  struct Tile
+  {
+    std::atomic<uint64_t> lastUse;
+    // rows of TILE_SIZE texels packed like glm::packUnorm4x8, texels outside of the level repeat its edge
+    uint32_t texels[TILE_SIZE * TILE_SIZE];
+  };
+  struct Level
+  {
+    uint32_t width;
+    uint32_t height;
+    uint32_t tilesPerRow;
+    // of the row major texels in the file
+    uint64_t fileOffset;
+    // index of the first tile of the level in CachedTexture::tiles
+    size_t firstTile;
+  };
+  struct CachedTexture
+  {
+    std::unique_ptr<MappedFile> file;
+    uint32_t width;
+    uint32_t height;
+    std::vector<Level> levels;
+    std::unique_ptr<std::atomic<Tile*>[]> tiles;
+    size_t numTiles;
+  };
+  uint32_t texel(const CachedTexture& texture, const Level& level, uint32_t x, uint32_t y) const;
+  Tile* loadTile(const CachedTexture& texture, const Level& level, uint32_t tx, uint32_t ty) const;
+  std::vector<CachedTexture> textures;
+  uint64_t budget;
+  mutable std::atomic<uint64_t> residentBytes = 0;
+  // whether the current pass read from the mapped files
+  mutable std::atomic<bool> readFiles = false;
+  uint64_t epoch = 1;
+};
@@ -1,19 +1,23 @@
 #include "TextureLoader.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
+#include <iostream>
+#include <string>
 
-PTexture TextureLoader::loadTexture(std::string_view filename)
+PEnvironmentMap TextureLoader::loadEnvironmentMap(std::string_view filename)
 {
   int x, y, n;
-  auto* data = stbi_load(filename.data(), &x, &y, &n, 3);
-  std::vector<glm::vec3> texData(x * y);
-  for (uint32_t i = 0; i < texData.size(); ++i)
+  auto* data = stbi_loadf(std::string(filename).c_str(), &x, &y, &n, 3);
+  if (data == nullptr)
   {
-    texData[i] = glm::vec3(data[i * 3 + 0] / 256.f, data[i * 3 + 1] / 256.f, data[i * 3 + 2] / 256.f);
+    std::cout << "Could not load " << filename << std::endl;
+    return nullptr;
   }
-  auto result = std::make_unique<Texture>();
-  result->textureData = std::move(texData);
-  result->width = x;
-  result->height = y;
-  return result;
-}
\ No newline at end of file
+  std::vector<glm::vec3> texels(x * y);
+  for (size_t i = 0; i < texels.size(); ++i)
+  {
+    texels[i] = glm::vec3(data[3 * i], data[3 * i + 1], data[3 * i + 2]);
+  }
+  stbi_image_free(data);
+  return std::make_unique<EnvironmentMap>(x, y, texels);
+}
@@ -1,11 +1,12 @@
 #pragma once
 #include <string_view>
-#include "Texture.h"
+#include "EnvironmentMap.h"
 
 class TextureLoader
 {
 public:
-  static PTexture loadTexture(std::string_view filename);
+  // hdr or ldr equirectangular image, stb_image converts ldr files to linear
+  static PEnvironmentMap loadEnvironmentMap(std::string_view filename);
 
 private:
 };
\ No newline at end of file
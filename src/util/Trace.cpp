@@ -0,0 +1,80 @@
+#include "Trace.h"
+#include <chrono>
+#include <fstream>
+
+std::atomic_bool Trace::enabled = false;
+std::mutex Trace::threadsLock;
+std::vector<std::unique_ptr<TraceBuffer>> Trace::threads;
+
+static const auto epoch = std::chrono::steady_clock::now();
+
+void Trace::setEnabled(bool enable)
+{
+  if (enable && !enabled)
+  {
+    std::unique_lock l(threadsLock);
+    for (auto& thread : threads)
+    {
+      std::unique_lock bl(thread->lock);
+      thread->events.clear();
+    }
+  }
+  enabled.store(enable);
+}
+
+void Trace::setThreadName(std::string_view name)
+{
+  TraceBuffer& buffer = local();
+  std::unique_lock l(buffer.lock);
+  buffer.threadName = std::string(name) + " " + std::to_string(buffer.threadId);
+}
+
+uint64_t Trace::now()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Trace::record(const char* name, uint64_t begin, uint64_t end)
+{
+  TraceBuffer& buffer = local();
+  std::unique_lock l(buffer.lock);
+  buffer.events.push_back(TraceEvent{
+      .name = name,
+      .begin = begin,
+      .end = end,
+  });
+}
+
+void Trace::writeChromeJson(std::string_view filename)
+{
+  std::ofstream out{std::string(filename)};
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  bool first = true;
+  std::unique_lock l(threadsLock);
+  for (auto& thread : threads)
+  {
+    std::unique_lock bl(thread->lock);
+    if (!thread->threadName.empty())
+    {
+      out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": " << thread->threadId
+          << ", \"args\": {\"name\": \"" << thread->threadName << "\"}}";
+      first = false;
+    }
+    for (const auto& event : thread->events)
+    {
+      out << (first ? "" : ",\n") << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << thread->threadId
+          << ", \"ts\": " << event.begin << ", \"dur\": " << event.end - event.begin << "}";
+      first = false;
+    }
+  }
+  out << "\n]}\n";
+}
+
+TraceBuffer& Trace::registerThread()
+{
+  // buffers outlive their thread so a recording keeps the events of finished render threads
+  std::unique_lock l(threadsLock);
+  threads.push_back(std::make_unique<TraceBuffer>());
+  threads.back()->threadId = (uint32_t)threads.size() - 1;
+  return *threads.back();
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// timeline of scoped events, exported in the chrome trace format
+// which chrome://tracing and ui.perfetto.dev can open
+// while recording is off a TRACE_SCOPE costs one relaxed load,
+// defining RAYTRACER_NO_TRACE compiles the scopes out entirely
+
+struct TraceEvent
+{
+  // only the pointer is stored, so this has to be a string literal
+  const char* name;
+  // microseconds since the first use of Trace
+  uint64_t begin;
+  uint64_t end;
+};
+
+// events of a single thread, the lock is only contended while exporting
+struct TraceBuffer
+{
+  uint32_t threadId;
+  std::string threadName;
+  std::mutex lock;
+  std::vector<TraceEvent> events;
+};
+
+class Trace
+{
+public:
+  static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+  // enabling starts a new recording
+  static void setEnabled(bool enable);
+  static void setThreadName(std::string_view name);
+  static uint64_t now();
+  static void record(const char* name, uint64_t begin, uint64_t end);
+  static void writeChromeJson(std::string_view filename);
+
+private:
+  static TraceBuffer& local()
+  {
+    thread_local TraceBuffer& buffer = registerThread();
+    return buffer;
+  }
+  static TraceBuffer& registerThread();
+  static std::atomic_bool enabled;
+  static std::mutex threadsLock;
+  static std::vector<std::unique_ptr<TraceBuffer>> threads;
+};
+
+class TraceScope
+{
+public:
+  TraceScope(const char* name) : name(name), active(Trace::isEnabled()), begin(active ? Trace::now() : 0) {}
+  ~TraceScope()
+  {
+    if (active)
+      Trace::record(name, begin, Trace::now());
+  }
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+  const char* name;
+  bool active;
+  uint64_t begin;
+};
+
+#ifdef RAYTRACER_NO_TRACE
+#define TRACE_SCOPE(name)
+#else
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#endif